@@ -164,6 +164,22 @@ enum filter_op {
 	FILTER_OP_EQ_STAR_GLOB_STRING		= 77,
 	FILTER_OP_NE_STAR_GLOB_STRING		= 78,
 
+	/*
+	 * load integer element of an array or sequence field. The
+	 * field_ref offset indexes the runtime index reference table.
+	 */
+	FILTER_OP_LOAD_FIELD_REF_INDEX_S64	= 79,
+
+	/* s64 set membership and range tests: apply to */
+	FILTER_OP_IN_SET_S64			= 80,
+	FILTER_OP_IN_RANGE_S64			= 81,
+
+	/*
+	 * Precompiled string literal. Only produced by the kernel
+	 * specializer, never accepted from user-space.
+	 */
+	FILTER_OP_LOAD_STRING_MATCHER		= 82,
+
 	NR_FILTER_OPS,
 };
 
@@ -197,4 +213,18 @@ struct return_op {
 	filter_opcode_t op;
 } __attribute__((packed));
 
+/* values sorted in strictly increasing order */
+struct set_op {
+	filter_opcode_t op;
+	uint16_t nr_values;
+	int64_t values[0];
+} __attribute__((packed));
+
+/* lo and hi are inclusive */
+struct range_op {
+	filter_opcode_t op;
+	int64_t lo;
+	int64_t hi;
+} __attribute__((packed));
+
 #endif /* _FILTER_BYTECODE_H */
@@ -89,6 +89,20 @@ LTTNG_TRACEPOINT_EVENT(lttng_statedump_file_descriptor,
 	)
 )
 
+/*
+ * Process @p shares its file descriptor table with process owner_pid,
+ * whose file descriptors were dumped instead.
+ */
+LTTNG_TRACEPOINT_EVENT(lttng_statedump_shared_fd_table,
+	TP_PROTO(struct lttng_session *session,
+		struct task_struct *p, pid_t owner_pid),
+	TP_ARGS(session, p, owner_pid),
+	TP_FIELDS(
+		ctf_integer(pid_t, pid, p->tgid)
+		ctf_integer(pid_t, owner_pid, owner_pid)
+	)
+)
+
 LTTNG_TRACEPOINT_EVENT(lttng_statedump_vm_map,
 	TP_PROTO(struct lttng_session *session,
 		struct task_struct *p, struct vm_area_struct *map,
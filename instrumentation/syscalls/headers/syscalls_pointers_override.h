@@ -12,6 +12,66 @@ SC_LTTNG_TRACEPOINT_EVENT(execve,
 	)
 )
 
+/*
+ * read(2) and write(2) optionally record a prefix of their data buffer,
+ * see the syscall_{read,write}_snaplen parameters in lttng-syscalls.c.
+ * read(2) records what was returned, write(2) what was submitted.
+ * The read(2) exit event also carries fd and count, so it can be traced
+ * without its entry event.
+ */
+#define OVERRIDE_32_read
+#define OVERRIDE_64_read
+SC_LTTNG_TRACEPOINT_EVENT_CODE(read,
+	TP_PROTO(sc_exit(long ret,) unsigned int fd, char *buf, size_t count),
+	TP_ARGS(sc_exit(ret,) fd, buf, count),
+	TP_locvar(
+		unsigned int snaplen;
+	),
+	TP_code_pre(
+		tp_locvar->snaplen = 0;
+		sc_out(
+			tp_locvar->snaplen = lttng_syscall_payload_snaplen(
+				READ_ONCE(syscall_read_snaplen), ret);
+		)
+	),
+	TP_FIELDS(
+		sc_exit(ctf_integer(long, ret, ret))
+		sc_inout(ctf_integer(unsigned int, fd, fd))
+		sc_out(ctf_integer(char *, buf, buf))
+		sc_inout(ctf_integer(size_t, count, count))
+		sc_out(ctf_user_sequence_text(char, payload, buf,
+			unsigned int, tp_locvar->snaplen))
+	),
+	TP_code_post()
+)
+
+#define OVERRIDE_32_write
+#define OVERRIDE_64_write
+SC_LTTNG_TRACEPOINT_EVENT_CODE(write,
+	TP_PROTO(sc_exit(long ret,) unsigned int fd, const char *buf, size_t count),
+	TP_ARGS(sc_exit(ret,) fd, buf, count),
+	TP_locvar(
+		unsigned int snaplen;
+	),
+	TP_code_pre(
+		tp_locvar->snaplen = 0;
+		sc_in(
+			tp_locvar->snaplen = lttng_syscall_payload_snaplen(
+				READ_ONCE(syscall_write_snaplen),
+				min_t(size_t, count, LONG_MAX));
+		)
+	),
+	TP_FIELDS(
+		sc_exit(ctf_integer(long, ret, ret))
+		sc_in(ctf_integer(unsigned int, fd, fd))
+		sc_in(ctf_integer(const char *, buf, buf))
+		sc_in(ctf_integer(size_t, count, count))
+		sc_in(ctf_user_sequence_text(char, payload, buf,
+			unsigned int, tp_locvar->snaplen))
+	),
+	TP_code_post()
+)
+
 #define OVERRIDE_32_clone
 #define OVERRIDE_64_clone
 SC_LTTNG_TRACEPOINT_EVENT(clone,
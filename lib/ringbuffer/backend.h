@@ -71,6 +71,17 @@ extern void *
 lib_ring_buffer_read_offset_address(struct lib_ring_buffer_backend *bufb,
 				    size_t offset);
 
+/*
+ * Return a virtually contiguous mapping of the sub-buffer held by the
+ * reader, or NULL if it cannot be mapped. The mapping is created on first
+ * use and kept with the sub-buffer pages until they are freed, or until
+ * lib_ring_buffer_read_vunmap() is called before replacing them.
+ */
+extern void *
+lib_ring_buffer_read_vmap(struct lib_ring_buffer_backend *bufb);
+extern void
+lib_ring_buffer_read_vunmap(struct lib_ring_buffer_backend *bufb);
+
 /**
  * lib_ring_buffer_write - write data to a buffer backend
  * @config : ring buffer instance configuration
@@ -46,7 +46,12 @@ int channel_backend_init(struct channel_backend *chanb,
 void channel_backend_free(struct channel_backend *chanb);
 
 void lib_ring_buffer_backend_reset(struct lib_ring_buffer_backend *bufb);
+int lib_ring_buffer_backend_reserve_spare(struct lib_ring_buffer_backend *bufb);
+void lib_ring_buffer_backend_unreserve_spare(struct lib_ring_buffer_backend *bufb);
+int lib_ring_buffer_backend_get_spare(struct lib_ring_buffer_backend *bufb);
+void lib_ring_buffer_backend_put_spare(struct lib_ring_buffer_backend *bufb);
 void channel_backend_reset(struct channel_backend *chanb);
+bool channel_backend_hotplug_park(void);
 
 int lib_ring_buffer_backend_init(void);
 void lib_ring_buffer_backend_exit(void);
@@ -25,6 +25,7 @@
 
 #include <linux/cpumask.h>
 #include <linux/types.h>
+#include <linux/spinlock.h>
 #include <lttng-kernel-version.h>
 #include <lttng-cpuhotplug.h>
 
@@ -38,6 +39,7 @@ struct lib_ring_buffer_backend_pages {
 	union v_atomic records_commit;	/* current records committed count */
 	union v_atomic records_unread;	/* records to read */
 	unsigned long data_size;	/* Amount of data to read from subbuf */
+	void *vmap;			/* Contiguous mapping for readers */
 	struct lib_ring_buffer_backend_page p[];
 };
 
@@ -82,6 +84,21 @@ struct lib_ring_buffer_backend {
 	unsigned int allocated:1;	/* is buffer allocated ? */
 };
 
+/*
+ * Reader sub-buffers shared by all buffers of an overwrite channel. A
+ * reader borrows one for the sub-buffer exchange while it holds a
+ * sub-buffer, and gives one back when it releases it. One spare is
+ * allocated for each buffer opened for reading.
+ */
+struct lib_ring_buffer_reader_pool {
+	spinlock_t lock;
+	struct lib_ring_buffer_backend_pages **spares;	/* Free spares */
+	unsigned int nr_spares;		/* Number of free spares */
+	unsigned int nr_alloc;		/* Free and borrowed spares */
+	unsigned int nr_readers;	/* Buffers opened for reading */
+	unsigned int max_spares;	/* One per buffer at most */
+};
+
 struct channel_backend {
 	unsigned long buf_size;		/* Size of the buffer */
 	unsigned long subbuf_size;	/* Sub-buffer size */
@@ -92,6 +109,8 @@ struct channel_backend {
 					 */
 	unsigned int buf_size_order;	/* Order of buffer size */
 	unsigned int extra_reader_sb:1;	/* has extra reader subbuffer ? */
+	unsigned int reader_pool:1;	/* extra subbuffer from reader_spares */
+	unsigned int hp_park:1;		/* park offline per-cpu buffers */
 	struct lib_ring_buffer *buf;	/* Channel per-cpu buffers */
 
 	unsigned long num_subbuf;	/* Number of sub-buffers for writer */
@@ -111,6 +130,7 @@ struct channel_backend {
 	 */
 	struct lib_ring_buffer_config config; /* Ring buffer configuration */
 	cpumask_var_t cpumask;		/* Allocated per-cpu buffers cpumask */
+	struct lib_ring_buffer_reader_pool reader_spares;
 	char name[NAME_MAX];		/* Channel name */
 };
 
@@ -117,6 +117,19 @@ struct lib_ring_buffer_client_cb {
  *
  * RING_BUFFER_WAKEUP_NONE does not perform any wakeup whatsoever. The client
  * has the responsibility to perform wakeups.
+ *
+ * reserve:
+ *
+ * RING_BUFFER_RESERVE_CMPXCHG updates the buffer write offset with a local
+ * cmpxchg on every reservation.
+ *
+ * RING_BUFFER_RESERVE_CURSOR is only valid with RING_BUFFER_SYNC_PER_CPU,
+ * and requires the client to bracket reservations with
+ * lib_ring_buffer_get_cpu() and lib_ring_buffer_put_cpu(). The outermost
+ * writer of a CPU updates the write offset with a plain store. Writers
+ * nested over it from interrupt or NMI context reserve after the
+ * outermost reservation through a separate cursor, which is merged back
+ * into the write offset when the outermost writer leaves its reservation.
  */
 struct lib_ring_buffer_config {
 	enum {
@@ -159,6 +172,10 @@ struct lib_ring_buffer_config {
 						 * (takes spinlock).
 						 */
 	} wakeup;
+	enum {
+		RING_BUFFER_RESERVE_CMPXCHG,
+		RING_BUFFER_RESERVE_CURSOR,
+	} reserve;
 	/*
 	 * tsc_bits: timestamp bits saved at each record.
 	 *   0 and 64 disable the timestamp compression scheme.
@@ -72,6 +72,16 @@ struct channel *channel_create(const struct lib_ring_buffer_config *config,
 			       unsigned int switch_timer_interval,
 			       unsigned int read_timer_interval);
 
+/*
+ * lib_ring_buffer_budget_geometry derives the sub-buffer size and count
+ * of a channel from the memory available for all its buffers.
+ * num_subbuf is a hint on input, 0 selecting the default.
+ */
+extern
+int lib_ring_buffer_budget_geometry(uint64_t budget, int per_cpu,
+				    int overwrite, int extra_reader_sb,
+				    size_t *subbuf_size, size_t *num_subbuf);
+
 /*
  * channel_destroy returns the private data pointer. It finalizes all channel's
  * buffers, waits for readers to release all references, and destroys the
@@ -146,6 +156,12 @@ static inline void lib_ring_buffer_put_next_subbuf(struct lib_ring_buffer *buf)
 extern void channel_reset(struct channel *chan);
 extern void lib_ring_buffer_reset(struct lib_ring_buffer *buf);
 
+/*
+ * Discard buffered data while tracing is active (see lib_ring_buffer_clear).
+ */
+extern void lib_ring_buffer_clear(struct lib_ring_buffer *buf);
+extern void lib_ring_buffer_clear_channel(struct channel *chan);
+
 static inline
 unsigned long lib_ring_buffer_get_offset(const struct lib_ring_buffer_config *config,
 					 struct lib_ring_buffer *buf)
@@ -137,6 +137,53 @@ int lib_ring_buffer_try_reserve(const struct lib_ring_buffer_config *config,
 	return 0;
 }
 
+/*
+ * lib_ring_buffer_try_reserve_cursor is called by lib_ring_buffer_reserve()
+ * for the outermost writer of a RING_BUFFER_RESERVE_CURSOR buffer. See
+ * frontend_internal.h for the protocol.
+ *
+ * returns 0 if reserve ok, or 1 if the slow path must be taken.
+ */
+static inline
+int lib_ring_buffer_try_reserve_cursor(const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer_ctx *ctx,
+				unsigned long *o_begin, unsigned long *o_end,
+				size_t *before_hdr_pad)
+{
+	struct lib_ring_buffer *buf = ctx->buf;
+	unsigned long o_old;
+
+	WRITE_ONCE(buf->reserve_end, 0);
+	barrier();
+	WRITE_ONCE(buf->reserving, RESERVE_OUTER);
+	barrier();
+	if (unlikely(lib_ring_buffer_try_reserve(config, ctx, o_begin,
+						 o_end, &o_old, before_hdr_pad)))
+		goto restart;
+	WRITE_ONCE(buf->reserve_end, *o_end);
+	barrier();
+	if (unlikely(READ_ONCE(buf->reserving) != RESERVE_OUTER
+		     || v_read(config, &buf->offset) != o_old))
+		goto restart;
+	v_set(config, &buf->offset, *o_end);
+	barrier();
+	WRITE_ONCE(buf->reserving, RESERVE_NONE);
+	barrier();
+	if (unlikely(v_read(config, &buf->nested_end)
+		     || READ_ONCE(buf->switch_deferred)))
+		lib_ring_buffer_nested_complete(buf);
+	return 0;
+
+restart:
+	barrier();
+	WRITE_ONCE(buf->reserving, RESERVE_NONE);
+	barrier();
+	/* Do not leave a deferred switch pending across the slow path. */
+	if (unlikely(READ_ONCE(buf->switch_deferred)))
+		lib_ring_buffer_nested_complete(buf);
+	return 1;
+}
+
 /**
  * lib_ring_buffer_reserve - Reserve space in a ring buffer.
  * @config: ring buffer instance configuration.
@@ -173,6 +220,17 @@ int lib_ring_buffer_reserve(const struct lib_ring_buffer_config *config,
 		return -EAGAIN;
 	ctx->buf = buf;
 
+	if (config->reserve == RING_BUFFER_RESERVE_CURSOR) {
+		if (likely(per_cpu(lib_ring_buffer_nesting, ctx->cpu) == 1)) {
+			if (unlikely(lib_ring_buffer_try_reserve_cursor(config,
+					ctx, &o_begin, &o_end, &before_hdr_pad)))
+				goto slow_path;
+			goto reserved;
+		}
+		if (unlikely(lib_ring_buffer_nested_prepare(config, buf)))
+			goto slow_path;
+	}
+
 	/*
 	 * Perform retryable operations.
 	 */
@@ -184,6 +242,8 @@ int lib_ring_buffer_reserve(const struct lib_ring_buffer_config *config,
 		     != o_old))
 		goto slow_path;
 
+reserved:
+
 	/*
 	 * Atomically update last_tsc. This update races against concurrent
 	 * atomic updates, but the race will always cause supplementary full TSC
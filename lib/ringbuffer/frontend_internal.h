@@ -32,6 +32,7 @@
 #include <wrapper/ringbuffer/backend_types.h>
 #include <wrapper/ringbuffer/frontend_types.h>
 #include <lib/prio_heap/lttng_prio_heap.h>	/* For per-CPU read-side iterator */
+#include <wrapper/compiler.h>
 
 /* Buffer offset macros */
 
@@ -149,6 +150,83 @@ int last_tsc_overflow(const struct lib_ring_buffer_config *config,
 }
 #endif
 
+/*
+ * RING_BUFFER_RESERVE_CURSOR reservation.
+ *
+ * The outermost writer of a CPU (nesting count of 1) reserves with:
+ *
+ *   reserve_end = 0, reserving = RESERVE_OUTER
+ *   read offset, compute the reservation end
+ *   reserve_end = end
+ *   if reserving or offset changed: restart with cmpxchg
+ *   offset = end (plain store)
+ *   reserving = RESERVE_NONE
+ *   merge the nested cursor, perform deferred switch
+ *
+ * Each step is separated by a compiler barrier: the only concurrent
+ * writers are interrupt and NMI handlers nested over it on the same CPU,
+ * which run to completion before it resumes. A nested writer finding
+ * RESERVE_OUTER set either:
+ *
+ * - finds reserve_end still 0: the outermost writer has not published its
+ *   reservation yet. It sets RESERVE_INTERRUPTED so the outermost writer
+ *   restarts, and updates the offset with cmpxchg,
+ * - finds the offset equal to reserve_end: the outermost writer already
+ *   stored it, and the offset can be updated with cmpxchg,
+ * - otherwise, the plain store of reserve_end to the offset is pending.
+ *   The nested writer reserves after reserve_end through nested_end, and
+ *   leaves sub-buffer switches to the outermost writer.
+ */
+#define RESERVE_NONE		0
+#define RESERVE_OUTER		1
+#define RESERVE_INTERRUPTED	2
+
+/*
+ * Move the offset past nested cursor reservations. Only called when the
+ * offset can be updated with cmpxchg.
+ */
+static inline
+void lib_ring_buffer_nested_merge(const struct lib_ring_buffer_config *config,
+				  struct lib_ring_buffer *buf)
+{
+	unsigned long end, old;
+
+	end = v_read(config, &buf->nested_end);
+	if (likely(!end))
+		return;
+	do {
+		old = v_read(config, &buf->offset);
+		if ((long) (old - end) >= 0)
+			break;
+	} while (v_cmpxchg(config, &buf->offset, old, end) != old);
+	v_cmpxchg(config, &buf->nested_end, end, 0);
+}
+
+/*
+ * Returns 0 if the offset can be updated with cmpxchg from the current
+ * context, 1 if the reservation must go through the nested cursor.
+ */
+static inline
+int lib_ring_buffer_nested_prepare(const struct lib_ring_buffer_config *config,
+				   struct lib_ring_buffer *buf)
+{
+	if (config->reserve != RING_BUFFER_RESERVE_CURSOR)
+		return 0;
+	if (unlikely(READ_ONCE(buf->reserving) == RESERVE_OUTER)) {
+		unsigned long end = READ_ONCE(buf->reserve_end);
+
+		if (!end)
+			WRITE_ONCE(buf->reserving, RESERVE_INTERRUPTED);
+		else if (v_read(config, &buf->offset) != end)
+			return 1;
+	}
+	lib_ring_buffer_nested_merge(config, buf);
+	return 0;
+}
+
+extern
+void lib_ring_buffer_nested_complete(struct lib_ring_buffer *buf);
+
 extern
 int lib_ring_buffer_reserve_slow(struct lib_ring_buffer_ctx *ctx);
 
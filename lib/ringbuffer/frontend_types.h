@@ -41,6 +41,17 @@
  */
 enum switch_mode { SWITCH_ACTIVE, SWITCH_FLUSH };
 
+/*
+ * Cache line split layout, selected with
+ * CONFIG_LTTNG_RING_BUFFER_CACHELINE_SPLIT. It costs one cache line per
+ * sub-buffer per CPU, so the dense layout stays the default.
+ */
+#ifdef LTTNG_RING_BUFFER_CACHELINE_SPLIT
+#define lib_ring_buffer_split_aligned	____cacheline_aligned_in_smp
+#else
+#define lib_ring_buffer_split_aligned
+#endif
+
 /* channel-level read-side iterator */
 struct channel_iter {
 	/* Prio heap of buffers. Lowest timestamps at the top. */
@@ -84,15 +95,21 @@ struct channel {
 	wait_queue_head_t read_wait;		/* reader wait queue */
 	wait_queue_head_t hp_wait;		/* CPU hotplug wait queue */
 	int finalized;				/* Has channel been finalized */
+	int quiescent;				/* Channel set quiescent (stopped) */
 	struct channel_iter iter;		/* Channel read-side iterator */
 	struct kref ref;			/* Reference count */
 };
 
-/* Per-subbuffer commit counters used on the hot path */
+/*
+ * Per-subbuffer commit counters used on the hot path. With the cache line
+ * split layout, each sub-buffer gets its own cache line, so commits into
+ * adjacent sub-buffers, and the reader polling for delivery, do not bounce
+ * the same line between each other.
+ */
 struct commit_counters_hot {
 	union v_atomic cc;		/* Commit counter */
 	union v_atomic seq;		/* Consecutive commits */
-};
+} lib_ring_buffer_split_aligned;
 
 /* Per-subbuffer commit counters used only on cold paths */
 struct commit_counters_cold {
@@ -123,24 +140,21 @@ struct lib_ring_buffer {
 	union v_atomic offset;		/* Current offset in the buffer */
 	struct commit_counters_hot *commit_hot;
 					/* Commit count per sub-buffer */
-	atomic_long_t consumed;		/*
-					 * Current offset in the buffer
-					 * standard atomic access (shared)
-					 */
 	atomic_t record_disabled;
 	/* End of first 32 bytes cacheline */
 	union v_atomic last_tsc;	/*
 					 * Last timestamp written in the buffer.
 					 */
+	/* RING_BUFFER_RESERVE_CURSOR state, see frontend_internal.h */
+	unsigned long reserve_end;	/* Outermost reservation end */
+	union v_atomic nested_end;	/* Nested cursor, 0 once merged */
+	int reserving;			/* Outermost reservation state */
+	int switch_deferred;		/* Switch left to outermost writer */
 
 	struct lib_ring_buffer_backend backend;	/* Associated backend */
 
 	struct commit_counters_cold *commit_cold;
 					/* Commit count per sub-buffer */
-	atomic_long_t active_readers;	/*
-					 * Active readers count
-					 * standard atomic access (shared)
-					 */
 					/* Dropped records */
 	union v_atomic records_lost_full;	/* Buffer full */
 	union v_atomic records_lost_wrap;	/* Nested wrap-around */
@@ -153,14 +167,35 @@ struct lib_ring_buffer {
 	struct timer_list switch_timer;	/* timer for periodical switch */
 	struct timer_list read_timer;	/* timer for read poll */
 	raw_spinlock_t raw_tick_nohz_spinlock;	/* nohz entry lock/trylock */
-	struct lib_ring_buffer_iter iter;	/* read-side iterator */
-	unsigned long get_subbuf_consumed;	/* Read-side consumed */
-	unsigned long prod_snapshot;	/* Producer count snapshot */
-	unsigned long cons_snapshot;	/* Consumer count snapshot */
 	unsigned int get_subbuf:1,	/* Sub-buffer being held by reader */
 		switch_timer_enabled:1,	/* Protected by ring_buffer_nohz_lock */
 		read_timer_enabled:1,	/* Protected by ring_buffer_nohz_lock */
 		quiescent:1;
+
+	/*
+	 * Reader state, on its own cacheline with the cache line split
+	 * layout: the reader updates it for every sub-buffer it consumes,
+	 * while writers only read "consumed" when switching sub-buffer.
+	 */
+	atomic_long_t consumed lib_ring_buffer_split_aligned;
+					/*
+					 * Current offset in the buffer
+					 * standard atomic access (shared)
+					 */
+	atomic_long_t active_readers;	/*
+					 * Active readers count
+					 * standard atomic access (shared)
+					 */
+	unsigned long get_subbuf_consumed;	/* Read-side consumed */
+	atomic_long_t clear_consumed;	/*
+					 * Consumed offset requested by a
+					 * clear, applied by the reader
+					 * (discard mode)
+					 */
+	unsigned long prod_snapshot;	/* Producer count snapshot */
+	unsigned long cons_snapshot;	/* Consumer count snapshot */
+	void *read_priv;		/* Reader state owned by the client */
+	struct lib_ring_buffer_iter iter;	/* read-side iterator */
 };
 
 static inline
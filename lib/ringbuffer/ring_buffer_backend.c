@@ -34,6 +34,26 @@
 #include <wrapper/ringbuffer/backend.h>
 #include <wrapper/ringbuffer/frontend.h>
 
+/*
+ * When set, per-cpu channels allocate the buffers of all possible CPUs
+ * at creation, and the buffer of a CPU going offline is parked in
+ * quiescent state rather than left active. Bringing the CPU back online
+ * then resumes the parked buffer without allocating anything.
+ */
+static bool hotplug_park;
+module_param(hotplug_park, bool, 0644);
+MODULE_PARM_DESC(hotplug_park,
+	"Preallocate per-cpu buffers of possible CPUs and park them while offline");
+
+/*
+ * Whether per-cpu channels created now allocate the buffers of all
+ * possible CPUs.
+ */
+bool channel_backend_hotplug_park(void)
+{
+	return READ_ONCE(hotplug_park);
+}
+
 /**
  * lib_ring_buffer_backend_allocate - allocate a channel buffer
  * @config: ring buffer instance configuration
@@ -51,7 +71,7 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 	struct channel_backend *chanb = &bufb->chan->backend;
 	unsigned long j, num_pages, num_pages_per_subbuf, page_idx = 0;
 	unsigned long subbuf_size, mmap_offset = 0;
-	unsigned long num_subbuf_alloc;
+	unsigned long num_subbuf_alloc, num_subbuf_populate;
 	struct page **pages;
 	unsigned long i;
 
@@ -60,10 +80,16 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 	subbuf_size = chanb->subbuf_size;
 	num_subbuf_alloc = num_subbuf;
 
-	if (extra_reader_sb) {
-		num_pages += num_pages_per_subbuf; /* Add pages for reader */
+	if (extra_reader_sb)
 		num_subbuf_alloc++;
-	}
+	/*
+	 * With a reader pool, the reader subbuffer slot stays empty until
+	 * the reader borrows a spare.
+	 */
+	num_subbuf_populate = num_subbuf_alloc;
+	if (extra_reader_sb && chanb->reader_pool)
+		num_subbuf_populate--;
+	num_pages = num_pages_per_subbuf * num_subbuf_populate;
 
 	pages = vmalloc_node(ALIGN(sizeof(*pages) * num_pages,
 				   1 << INTERNODE_CACHE_SHIFT),
@@ -71,7 +97,7 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 	if (unlikely(!pages))
 		goto pages_error;
 
-	bufb->array = lttng_kvmalloc_node(ALIGN(sizeof(*bufb->array)
+	bufb->array = lttng_kvzalloc_node(ALIGN(sizeof(*bufb->array)
 					 * num_subbuf_alloc,
 				  1 << INTERNODE_CACHE_SHIFT),
 			GFP_KERNEL | __GFP_NOWARN,
@@ -88,7 +114,7 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 	bufb->num_pages_per_subbuf = num_pages_per_subbuf;
 
 	/* Allocate backend pages array elements */
-	for (i = 0; i < num_subbuf_alloc; i++) {
+	for (i = 0; i < num_subbuf_populate; i++) {
 		bufb->array[i] =
 			lttng_kvzalloc_node(ALIGN(
 				sizeof(struct lib_ring_buffer_backend_pages) +
@@ -132,7 +158,7 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 		goto free_wsb;
 
 	/* Assign pages to page index */
-	for (i = 0; i < num_subbuf_alloc; i++) {
+	for (i = 0; i < num_subbuf_populate; i++) {
 		for (j = 0; j < num_pages_per_subbuf; j++) {
 			CHAN_WARN_ON(chanb, page_idx > num_pages);
 			bufb->array[i]->p[j].virt = page_address(pages[page_idx]);
@@ -194,6 +220,11 @@ void lib_ring_buffer_backend_free(struct lib_ring_buffer_backend *bufb)
 	lttng_kvfree(bufb->buf_wsb);
 	lttng_kvfree(bufb->buf_cnt);
 	for (i = 0; i < num_subbuf_alloc; i++) {
+		/* Empty reader slot of a reader pool channel. */
+		if (!bufb->array[i])
+			continue;
+		if (bufb->array[i]->vmap)
+			vunmap(bufb->array[i]->vmap);
 		for (j = 0; j < bufb->num_pages_per_subbuf; j++)
 			__free_page(pfn_to_page(bufb->array[i]->p[j].pfn));
 		lttng_kvfree(bufb->array[i]);
@@ -213,6 +244,16 @@ void lib_ring_buffer_backend_reset(struct lib_ring_buffer_backend *bufb)
 	if (chanb->extra_reader_sb)
 		num_subbuf_alloc++;
 
+	if (chanb->reader_pool) {
+		unsigned long rsb_bindex;
+
+		/*
+		 * The reader slot may be empty: keep it the reader slot
+		 * once the subbuffer ids are reset.
+		 */
+		rsb_bindex = subbuffer_id_get_index(config, bufb->buf_rsb.id);
+		swap(bufb->array[rsb_bindex], bufb->array[num_subbuf_alloc - 1]);
+	}
 	for (i = 0; i < chanb->num_subbuf; i++)
 		bufb->buf_wsb[i].id = subbuffer_id(config, 0, 1, i);
 	if (chanb->extra_reader_sb)
@@ -222,6 +263,8 @@ void lib_ring_buffer_backend_reset(struct lib_ring_buffer_backend *bufb)
 		bufb->buf_rsb.id = subbuffer_id(config, 0, 1, 0);
 
 	for (i = 0; i < num_subbuf_alloc; i++) {
+		if (!bufb->array[i])
+			continue;
 		/* Don't reset mmap_offset */
 		v_set(config, &bufb->array[i]->records_commit, 0);
 		v_set(config, &bufb->array[i]->records_unread, 0);
@@ -232,6 +275,190 @@ void lib_ring_buffer_backend_reset(struct lib_ring_buffer_backend *bufb)
 	v_set(config, &bufb->records_read, 0);
 }
 
+static
+void lib_ring_buffer_backend_free_spare(struct lib_ring_buffer_backend_pages *spare,
+					unsigned long num_pages_per_subbuf)
+{
+	unsigned long i;
+
+	if (spare->vmap)
+		vunmap(spare->vmap);
+	for (i = 0; i < num_pages_per_subbuf; i++) {
+		if (!spare->p[i].pfn)
+			break;
+		__free_page(pfn_to_page(spare->p[i].pfn));
+	}
+	lttng_kvfree(spare);
+}
+
+static
+struct lib_ring_buffer_backend_pages *
+	lib_ring_buffer_backend_alloc_spare(unsigned long num_pages_per_subbuf,
+					    int cpu)
+{
+	struct lib_ring_buffer_backend_pages *spare;
+	int node = cpu_to_node(max(cpu, 0));
+	unsigned long i;
+
+	spare = lttng_kvzalloc_node(ALIGN(
+				sizeof(struct lib_ring_buffer_backend_pages) +
+				sizeof(struct lib_ring_buffer_backend_page)
+				* num_pages_per_subbuf,
+				1 << INTERNODE_CACHE_SHIFT),
+				GFP_KERNEL | __GFP_NOWARN, node);
+	if (!spare)
+		return NULL;
+	for (i = 0; i < num_pages_per_subbuf; i++) {
+		struct page *page;
+
+		page = alloc_pages_node(node,
+				GFP_KERNEL | __GFP_NOWARN | __GFP_ZERO, 0);
+		if (unlikely(!page)) {
+			lib_ring_buffer_backend_free_spare(spare,
+					num_pages_per_subbuf);
+			return NULL;
+		}
+		spare->p[i].virt = page_address(page);
+		spare->p[i].pfn = page_to_pfn(page);
+	}
+	/* The spare will be accessed by writers once exchanged. */
+	wrapper_vmalloc_sync_all();
+	return spare;
+}
+
+/**
+ * lib_ring_buffer_backend_reserve_spare - reserve a reader subbuffer
+ * @bufb: buffer backend
+ *
+ * Called when the buffer is opened for reading. With a reader pool,
+ * makes sure the pool holds one spare per buffer opened for reading,
+ * allocating one if needed. A reader therefore always finds a free spare
+ * in lib_ring_buffer_backend_get_spare().
+ *
+ * Returns 0 on success, -ENOMEM if the spare cannot be allocated.
+ */
+int lib_ring_buffer_backend_reserve_spare(struct lib_ring_buffer_backend *bufb)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+	struct lib_ring_buffer_reader_pool *pool = &chanb->reader_spares;
+	struct lib_ring_buffer_backend_pages *spare;
+	int need_spare;
+
+	if (!chanb->reader_pool)
+		return 0;
+	spin_lock(&pool->lock);
+	need_spare = pool->nr_alloc <= pool->nr_readers;
+	if (!need_spare)
+		pool->nr_readers++;
+	spin_unlock(&pool->lock);
+	if (!need_spare)
+		return 0;
+	spare = lib_ring_buffer_backend_alloc_spare(bufb->num_pages_per_subbuf,
+						    bufb->cpu);
+	if (!spare)
+		return -ENOMEM;
+	spin_lock(&pool->lock);
+	pool->spares[pool->nr_spares++] = spare;
+	pool->nr_alloc++;
+	pool->nr_readers++;
+	spin_unlock(&pool->lock);
+	return 0;
+}
+
+/**
+ * lib_ring_buffer_backend_unreserve_spare - release a reader subbuffer
+ * @bufb: buffer backend
+ *
+ * Called when the buffer is released for reading. Gives back the reader
+ * subbuffer, and frees a spare the remaining readers do not need.
+ */
+void lib_ring_buffer_backend_unreserve_spare(struct lib_ring_buffer_backend *bufb)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+	struct lib_ring_buffer_reader_pool *pool = &chanb->reader_spares;
+	struct lib_ring_buffer_backend_pages *spare = NULL;
+
+	if (!chanb->reader_pool)
+		return;
+	lib_ring_buffer_backend_put_spare(bufb);
+	spin_lock(&pool->lock);
+	pool->nr_readers--;
+	if (pool->nr_alloc > pool->nr_readers && pool->nr_spares) {
+		spare = pool->spares[--pool->nr_spares];
+		pool->nr_alloc--;
+	}
+	spin_unlock(&pool->lock);
+	if (spare)
+		lib_ring_buffer_backend_free_spare(spare,
+				bufb->num_pages_per_subbuf);
+}
+
+/**
+ * lib_ring_buffer_backend_get_spare - borrow a reader subbuffer
+ * @bufb: buffer backend
+ *
+ * Called by the reader, in process context, before exchanging a
+ * subbuffer. With a reader pool, fills the empty reader slot with a
+ * spare from the channel pool. The spare was reserved when the buffer
+ * was opened for reading, so this does not allocate.
+ */
+int lib_ring_buffer_backend_get_spare(struct lib_ring_buffer_backend *bufb)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	struct lib_ring_buffer_reader_pool *pool = &chanb->reader_spares;
+	struct lib_ring_buffer_backend_pages *spare = NULL;
+	unsigned long sb_bindex;
+
+	if (!chanb->reader_pool)
+		return 0;
+	sb_bindex = subbuffer_id_get_index(config, bufb->buf_rsb.id);
+	if (bufb->array[sb_bindex])
+		return 0;
+	spin_lock(&pool->lock);
+	if (pool->nr_spares)
+		spare = pool->spares[--pool->nr_spares];
+	spin_unlock(&pool->lock);
+	if (CHAN_WARN_ON(chanb, !spare))
+		return -EBUSY;
+	bufb->array[sb_bindex] = spare;
+	return 0;
+}
+
+/**
+ * lib_ring_buffer_backend_put_spare - give back the reader subbuffer
+ * @bufb: buffer backend
+ *
+ * Called by the reader once it no longer holds a subbuffer. The reader
+ * slot then contains a subbuffer no writer refers to, which is returned
+ * to the channel pool.
+ */
+void lib_ring_buffer_backend_put_spare(struct lib_ring_buffer_backend *bufb)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	struct lib_ring_buffer_reader_pool *pool = &chanb->reader_spares;
+	struct lib_ring_buffer_backend_pages *spare;
+	unsigned long sb_bindex;
+
+	if (!chanb->reader_pool)
+		return;
+	sb_bindex = subbuffer_id_get_index(config, bufb->buf_rsb.id);
+	spare = bufb->array[sb_bindex];
+	if (!spare)
+		return;
+	bufb->array[sb_bindex] = NULL;
+	spin_lock(&pool->lock);
+	if (!CHAN_WARN_ON(chanb, pool->nr_spares >= pool->max_spares)) {
+		pool->spares[pool->nr_spares++] = spare;
+		spare = NULL;
+	}
+	spin_unlock(&pool->lock);
+	if (spare)
+		lib_ring_buffer_backend_free_spare(spare,
+				bufb->num_pages_per_subbuf);
+}
+
 /*
  * The frontend is responsible for also calling ring_buffer_backend_reset for
  * each buffer when calling channel_backend_reset.
@@ -394,13 +621,33 @@ int channel_backend_init(struct channel_backend *chanb,
 	chanb->num_subbuf_order = get_count_order(num_subbuf);
 	chanb->extra_reader_sb =
 			(config->mode == RING_BUFFER_OVERWRITE) ? 1 : 0;
+	/*
+	 * The mmap layout exposes the reader subbuffer of each buffer at
+	 * a fixed offset, so only non-mmap readers share a reader pool.
+	 */
+	chanb->reader_pool = (config->mode == RING_BUFFER_OVERWRITE
+			&& config->output != RING_BUFFER_MMAP) ? 1 : 0;
+	chanb->hp_park = (config->alloc == RING_BUFFER_ALLOC_PER_CPU
+			&& channel_backend_hotplug_park()) ? 1 : 0;
 	chanb->num_subbuf = num_subbuf;
 	strlcpy(chanb->name, name, NAME_MAX);
 	memcpy(&chanb->config, config, sizeof(chanb->config));
 
+	if (chanb->reader_pool) {
+		struct lib_ring_buffer_reader_pool *pool = &chanb->reader_spares;
+
+		spin_lock_init(&pool->lock);
+		pool->max_spares = config->alloc == RING_BUFFER_ALLOC_PER_CPU ?
+				num_possible_cpus() : 1;
+		pool->spares = kcalloc(pool->max_spares, sizeof(*pool->spares),
+				GFP_KERNEL);
+		if (!pool->spares)
+			return -ENOMEM;
+	}
+
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
 		if (!zalloc_cpumask_var(&chanb->cpumask, GFP_KERNEL))
-			return -ENOMEM;
+			goto free_spares;
 	}
 
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
@@ -415,6 +662,22 @@ int channel_backend_init(struct channel_backend *chanb,
 			&chanb->cpuhp_prepare.node);
 		if (ret)
 			goto free_bufs;
+		if (chanb->hp_park) {
+			/*
+			 * Offline CPUs get their buffer now, so the prepare
+			 * callback finds it allocated when they come up.
+			 */
+			get_online_cpus();
+			for_each_possible_cpu(i) {
+				ret = lib_ring_buffer_create(per_cpu_ptr(chanb->buf, i),
+							 chanb, i);
+				if (ret)
+					break;
+			}
+			put_online_cpus();
+			if (ret)
+				goto free_bufs;
+		}
 #else /* #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)) */
 
 		{
@@ -436,7 +699,8 @@ int channel_backend_init(struct channel_backend *chanb,
 			register_hotcpu_notifier(&chanb->cpu_hp_notifier);
 
 			get_online_cpus();
-			for_each_online_cpu(i) {
+			for_each_cpu(i, chanb->hp_park ?
+					cpu_possible_mask : cpu_online_mask) {
 				ret = lib_ring_buffer_create(per_cpu_ptr(chanb->buf, i),
 							 chanb, i);
 				if (ret)
@@ -491,6 +755,8 @@ free_bufs:
 free_cpumask:
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU)
 		free_cpumask_var(chanb->cpumask);
+free_spares:
+	kfree(chanb->reader_spares.spares);
 	return -ENOMEM;
 }
 
@@ -545,6 +811,14 @@ void channel_backend_free(struct channel_backend *chanb)
 		lib_ring_buffer_free(buf);
 		kfree(buf);
 	}
+	if (chanb->reader_pool) {
+		struct lib_ring_buffer_reader_pool *pool = &chanb->reader_spares;
+
+		for (i = 0; i < pool->nr_spares; i++)
+			lib_ring_buffer_backend_free_spare(pool->spares[i],
+					chanb->subbuf_size >> PAGE_SHIFT);
+		kfree(pool->spares);
+	}
 }
 
 /**
@@ -906,6 +1180,67 @@ size_t lib_ring_buffer_read(struct lib_ring_buffer_backend *bufb, size_t offset,
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_read);
 
+/**
+ * lib_ring_buffer_read_vmap - map the reader sub-buffer contiguously
+ * @bufb : buffer backend
+ *
+ * Should only be called with the sub-buffer held by the reader. Sub-buffer
+ * pages move between the writer table, the reader slot and, for reader
+ * pool channels, the other buffers of the channel: the mapping follows the
+ * pages, so each sub-buffer is only mapped once.
+ */
+void *lib_ring_buffer_read_vmap(struct lib_ring_buffer_backend *bufb)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	struct lib_ring_buffer_backend_pages *rpages;
+	struct page **pages;
+	unsigned long sb_bindex, id, i;
+
+	id = bufb->buf_rsb.id;
+	sb_bindex = subbuffer_id_get_index(config, id);
+	rpages = bufb->array[sb_bindex];
+	CHAN_WARN_ON(chanb, config->mode == RING_BUFFER_OVERWRITE
+		     && subbuffer_id_is_noref(config, id));
+	if (rpages->vmap)
+		return rpages->vmap;
+	pages = kmalloc_array(bufb->num_pages_per_subbuf, sizeof(*pages),
+			GFP_KERNEL);
+	if (!pages)
+		return NULL;
+	for (i = 0; i < bufb->num_pages_per_subbuf; i++)
+		pages[i] = pfn_to_page(rpages->p[i].pfn);
+	rpages->vmap = vmap(pages, bufb->num_pages_per_subbuf, VM_MAP,
+			PAGE_KERNEL);
+	kfree(pages);
+	return rpages->vmap;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_read_vmap);
+
+/**
+ * lib_ring_buffer_read_vunmap - drop the mapping of the reader sub-buffer
+ * @bufb : buffer backend
+ *
+ * Should only be called with the sub-buffer held by the reader, before
+ * replacing any of its pages: the mapping holds no page reference, and
+ * would otherwise keep pointing to the pages given away.
+ */
+void lib_ring_buffer_read_vunmap(struct lib_ring_buffer_backend *bufb)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	struct lib_ring_buffer_backend_pages *rpages;
+	unsigned long sb_bindex;
+
+	sb_bindex = subbuffer_id_get_index(config, bufb->buf_rsb.id);
+	rpages = bufb->array[sb_bindex];
+	if (!rpages->vmap)
+		return;
+	vunmap(rpages->vmap);
+	rpages->vmap = NULL;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_read_vunmap);
+
 /**
  * __lib_ring_buffer_copy_to_user - read data from ring_buffer to userspace
  * @bufb : buffer backend
@@ -54,6 +54,9 @@
 #include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/cpumask.h>
+#include <linux/math64.h>
 #include <asm/cacheflush.h>
 
 #include <wrapper/ringbuffer/config.h>
@@ -65,6 +68,7 @@
 #include <wrapper/kref.h>
 #include <wrapper/percpu-defs.h>
 #include <wrapper/timer.h>
+#include <wrapper/types.h>
 #include <wrapper/vmalloc.h>
 
 /*
@@ -98,6 +102,13 @@ void lib_ring_buffer_print_errors(struct channel *chan,
 static
 void _lib_ring_buffer_switch_remote(struct lib_ring_buffer *buf,
 		enum switch_mode mode);
+static
+void lib_ring_buffer_set_quiescent(struct lib_ring_buffer *buf);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)) || defined(CONFIG_HOTPLUG_CPU)
+static
+void lib_ring_buffer_resume_parked(struct channel *chan,
+		struct lib_ring_buffer *buf);
+#endif
 
 static
 int lib_ring_buffer_poll_deliver(const struct lib_ring_buffer_config *config,
@@ -181,8 +192,11 @@ void lib_ring_buffer_reset(struct lib_ring_buffer *buf)
 		v_set(config, &buf->commit_cold[i].cc_sb, 0);
 	}
 	atomic_long_set(&buf->consumed, 0);
+	atomic_long_set(&buf->clear_consumed, 0);
 	atomic_set(&buf->record_disabled, 0);
 	v_set(config, &buf->last_tsc, 0);
+	v_set(config, &buf->nested_end, 0);
+	buf->switch_deferred = 0;
 	lib_ring_buffer_backend_reset(&buf->backend);
 	/* Don't reset number of active readers */
 	v_set(config, &buf->records_lost_full, 0);
@@ -485,11 +499,34 @@ int lttng_cpuhp_rb_frontend_dead(unsigned int cpu,
 	 * CPU stopped running completely. Ensures that all data
 	 * from that remote CPU is flushed.
 	 */
-	lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+	if (chan->backend.hp_park)
+		lib_ring_buffer_set_quiescent(buf);
+	else
+		lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(lttng_cpuhp_rb_frontend_dead);
 
+int lttng_cpuhp_rb_frontend_prepare(unsigned int cpu,
+		struct lttng_cpuhp_node *node)
+{
+	struct channel *chan = container_of(node, struct channel,
+					    cpuhp_prepare);
+	struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf, cpu);
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+
+	CHAN_WARN_ON(chan, config->alloc == RING_BUFFER_ALLOC_GLOBAL);
+
+	/*
+	 * Resume a buffer parked when its CPU went offline, before the
+	 * CPU starts writing into it again.
+	 */
+	if (chan->backend.hp_park)
+		lib_ring_buffer_resume_parked(chan, buf);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lttng_cpuhp_rb_frontend_prepare);
+
 int lttng_cpuhp_rb_frontend_online(unsigned int cpu,
 		struct lttng_cpuhp_node *node)
 {
@@ -552,6 +589,12 @@ int lib_ring_buffer_cpu_hp_callback(struct notifier_block *nb,
 	CHAN_WARN_ON(chan, config->alloc == RING_BUFFER_ALLOC_GLOBAL);
 
 	switch (action) {
+	case CPU_UP_PREPARE:
+	case CPU_UP_PREPARE_FROZEN:
+		if (chan->backend.hp_park)
+			lib_ring_buffer_resume_parked(chan, buf);
+		return NOTIFY_OK;
+
 	case CPU_DOWN_FAILED:
 	case CPU_DOWN_FAILED_FROZEN:
 	case CPU_ONLINE:
@@ -575,7 +618,10 @@ int lib_ring_buffer_cpu_hp_callback(struct notifier_block *nb,
 		 * CPU stopped running completely. Ensures that all data
 		 * from that remote CPU is flushed.
 		 */
-		lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+		if (chan->backend.hp_park)
+			lib_ring_buffer_set_quiescent(buf);
+		else
+			lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
 		return NOTIFY_OK;
 
 	default:
@@ -749,6 +795,24 @@ static void lib_ring_buffer_clear_quiescent(struct lib_ring_buffer *buf)
 	buf->quiescent = false;
 }
 
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)) || defined(CONFIG_HOTPLUG_CPU)
+/*
+ * Called from the CPU up prepare callback, serialized against
+ * lib_ring_buffer_{set,clear}_quiescent_channel() by the CPU hotplug
+ * lock. A buffer parked while its CPU was offline goes back to active
+ * unless the channel itself is stopped, in which case it stays
+ * quiescent until the next session start.
+ */
+static void lib_ring_buffer_resume_parked(struct channel *chan,
+		struct lib_ring_buffer *buf)
+{
+	if (!buf->backend.allocated)
+		return;
+	if (!chan->quiescent)
+		lib_ring_buffer_clear_quiescent(buf);
+}
+#endif
+
 void lib_ring_buffer_set_quiescent_channel(struct channel *chan)
 {
 	int cpu;
@@ -756,6 +820,7 @@ void lib_ring_buffer_set_quiescent_channel(struct channel *chan)
 
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
 		get_online_cpus();
+		chan->quiescent = 1;
 		for_each_channel_cpu(cpu, chan) {
 			struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf,
 							      cpu);
@@ -778,10 +843,14 @@ void lib_ring_buffer_clear_quiescent_channel(struct channel *chan)
 
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
 		get_online_cpus();
+		chan->quiescent = 0;
 		for_each_channel_cpu(cpu, chan) {
 			struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf,
 							      cpu);
 
+			/* Parked buffers resume when their CPU comes up. */
+			if (chan->backend.hp_park && !cpu_online(cpu))
+				continue;
 			lib_ring_buffer_clear_quiescent(buf);
 		}
 		put_online_cpus();
@@ -793,6 +862,101 @@ void lib_ring_buffer_clear_quiescent_channel(struct channel *chan)
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_clear_quiescent_channel);
 
+/*
+ * Move the consumed position forward, up to consumed_new.
+ */
+static void lib_ring_buffer_push_consumed(struct lib_ring_buffer *buf,
+		unsigned long consumed_new)
+{
+	unsigned long consumed_old;
+
+	do {
+		consumed_old = atomic_long_read(&buf->consumed);
+		if ((long) consumed_old - (long) consumed_new >= 0)
+			return;
+	} while (atomic_long_cmpxchg(&buf->consumed, consumed_old,
+				consumed_new) != consumed_old);
+}
+
+/*
+ * lib_ring_buffer_clear_reader - push the consumer position to the
+ * beginning of the sub-buffer currently being written.
+ *
+ * In overwrite mode, the sub-buffer held by the reader has been exchanged
+ * out of the writer's reach, so the consumed position is pushed right
+ * away, as a writer would. Races with writers pushing the reader are
+ * handled by the cmpxchg loop.
+ *
+ * In discard mode, the reader reads sub-buffers in place: moving the
+ * consumed position past a sub-buffer the reader is holding, or about to
+ * get, would hand it back to writers. The new position is only recorded,
+ * and applied by the reader in lib_ring_buffer_get_subbuf(), when it
+ * holds no sub-buffer.
+ */
+static void lib_ring_buffer_clear_reader(struct lib_ring_buffer *buf,
+		struct channel *chan)
+{
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long offset, clear_old, clear_new;
+
+	offset = v_read(config, &buf->offset);
+	clear_new = subbuf_trunc(offset, chan);
+	if (config->mode == RING_BUFFER_OVERWRITE) {
+		lib_ring_buffer_push_consumed(buf, clear_new);
+		return;
+	}
+	do {
+		clear_old = atomic_long_read(&buf->clear_consumed);
+		if ((long) clear_old - (long) clear_new >= 0)
+			return;
+	} while (atomic_long_cmpxchg(&buf->clear_consumed, clear_old,
+				clear_new) != clear_old);
+}
+
+/**
+ * lib_ring_buffer_clear - discard the content of a ring buffer
+ * @buf: ring buffer
+ *
+ * Close the sub-buffer currently being written (if non-empty) and move the
+ * consumer position to the writer position, so that all data produced so far
+ * is discarded. Unlike lib_ring_buffer_reset(), this can be performed while
+ * tracing is active: writers keep going in the following sub-buffer. In
+ * overwrite mode, a reader holding a sub-buffer is handled as if it had
+ * been pushed by a writer. In discard mode, the sub-buffer held by the
+ * reader is left alone, and the data is discarded when the reader gets
+ * its next sub-buffer.
+ */
+void lib_ring_buffer_clear(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+
+	lib_ring_buffer_switch_remote(buf);
+	lib_ring_buffer_clear_reader(buf, chan);
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_clear);
+
+void lib_ring_buffer_clear_channel(struct channel *chan)
+{
+	int cpu;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+
+	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+		get_online_cpus();
+		for_each_channel_cpu(cpu, chan) {
+			struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf,
+							      cpu);
+
+			lib_ring_buffer_clear(buf);
+		}
+		put_online_cpus();
+	} else {
+		struct lib_ring_buffer *buf = chan->backend.buf;
+
+		lib_ring_buffer_clear(buf);
+	}
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_clear_channel);
+
 static void channel_free(struct channel *chan)
 {
 	if (chan->backend.release_priv_ops) {
@@ -938,6 +1102,60 @@ error:
 }
 EXPORT_SYMBOL_GPL(channel_create);
 
+/**
+ * lib_ring_buffer_budget_geometry - size channel buffers from a memory budget
+ * @budget: memory available for all the channel buffers, in bytes
+ * @per_cpu: whether the channel has one buffer per cpu
+ * @overwrite: whether the channel is in overwrite mode
+ * @extra_reader_sb: whether each buffer has an extra reader sub-buffer
+ * @subbuf_size: output, sub-buffer size
+ * @num_subbuf: sub-buffer count, hint on input (0 for the default)
+ *
+ * Per-cpu buffers are sized for the cpus present in the system, which
+ * bounds the memory used whatever the cpus brought online later, or for
+ * all possible cpus when offline cpus keep their parked buffer. The
+ * sub-buffer size and count are powers of 2, the sub-buffer count is
+ * lowered from the hint down to its minimum before the sub-buffers get
+ * smaller than a page.
+ *
+ * Returns 0 on success, -EINVAL if the budget is too small, or if the
+ * budget of each buffer does not fit in a size_t.
+ */
+int lib_ring_buffer_budget_geometry(uint64_t budget, int per_cpu,
+				    int overwrite, int extra_reader_sb,
+				    size_t *subbuf_size, size_t *num_subbuf)
+{
+	size_t buf_budget, nr_subbuf, min_subbuf, size;
+
+	if (per_cpu)
+		budget = div_u64(budget, channel_backend_hotplug_park() ?
+			num_possible_cpus() : num_present_cpus());
+	if (budget > LTTNG_SIZE_MAX)
+		return -EINVAL;
+	buf_budget = budget;
+	/* Overwrite mode needs at least 2 sub-buffers per buffer. */
+	min_subbuf = overwrite ? 2 : 1;
+	nr_subbuf = *num_subbuf ? *num_subbuf : 4;
+	if (nr_subbuf < min_subbuf)
+		nr_subbuf = min_subbuf;
+	nr_subbuf = rounddown_pow_of_two(nr_subbuf);
+
+	for (;;) {
+		size_t nr_alloc = nr_subbuf + (extra_reader_sb ? 1 : 0);
+
+		size = buf_budget / nr_alloc;
+		if (size >= PAGE_SIZE)
+			break;
+		if (nr_subbuf <= min_subbuf)
+			return -EINVAL;
+		nr_subbuf >>= 1;
+	}
+	*subbuf_size = rounddown_pow_of_two(size);
+	*num_subbuf = nr_subbuf;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_budget_geometry);
+
 static
 void channel_release(struct kref *kref)
 {
@@ -1030,6 +1248,12 @@ int lib_ring_buffer_open_read(struct lib_ring_buffer *buf)
 		atomic_long_dec(&buf->active_readers);
 		return -EOVERFLOW;
 	}
+	/* Reserve the reader spare now: getting a subbuffer does not allocate. */
+	if (lib_ring_buffer_backend_reserve_spare(&buf->backend)) {
+		kref_put(&chan->ref, channel_release);
+		atomic_long_dec(&buf->active_readers);
+		return -ENOMEM;
+	}
 	lttng_smp_mb__after_atomic();
 	return 0;
 }
@@ -1040,6 +1264,7 @@ void lib_ring_buffer_release_read(struct lib_ring_buffer *buf)
 	struct channel *chan = buf->backend.chan;
 
 	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+	lib_ring_buffer_backend_unreserve_spare(&buf->backend);
 	lttng_smp_mb__before_atomic();
 	atomic_long_dec(&buf->active_readers);
 	kref_put(&chan->ref, channel_release);
@@ -1247,6 +1472,14 @@ int lib_ring_buffer_get_subbuf(struct lib_ring_buffer *buf,
 		CHAN_WARN_ON(chan, 1);
 		return -EBUSY;
 	}
+	/* Apply a clear requested while the reader could hold a sub-buffer. */
+	if (config->mode == RING_BUFFER_DISCARD)
+		lib_ring_buffer_push_consumed(buf,
+				atomic_long_read(&buf->clear_consumed));
+	/* Borrow the subbuffer to exchange from the channel reader pool. */
+	ret = lib_ring_buffer_backend_get_spare(&buf->backend);
+	if (ret)
+		return ret;
 retry:
 	finalized = READ_ONCE(buf->finalized);
 	/*
@@ -1374,11 +1607,13 @@ nodata:
 	 * of "raw_spin_is_locked" memory ordering.
 	 */
 	if (finalized)
-		return -ENODATA;
+		ret = -ENODATA;
 	else if (raw_spin_is_locked(&buf->raw_tick_nohz_spinlock))
 		goto retry;
 	else
-		return -EAGAIN;
+		ret = -EAGAIN;
+	lib_ring_buffer_backend_put_spare(&buf->backend);
+	return ret;
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_get_subbuf);
 
@@ -1436,6 +1671,7 @@ void lib_ring_buffer_put_subbuf(struct lib_ring_buffer *buf)
 	 * update_read_sb_index return value ignored. Don't exchange sub-buffer
 	 * if the writer concurrently updated it.
 	 */
+	lib_ring_buffer_backend_put_spare(bufb);
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_put_subbuf);
 
@@ -1813,6 +2049,16 @@ void lib_ring_buffer_switch_slow(struct lib_ring_buffer *buf, enum switch_mode m
 
 	offsets.size = 0;
 
+	if (unlikely(lib_ring_buffer_nested_prepare(config, buf))) {
+		/*
+		 * Interrupting the outermost writer before it stores its
+		 * reservation: let it perform the switch when it leaves it.
+		 */
+		if (mode == SWITCH_FLUSH || !buf->switch_deferred)
+			WRITE_ONCE(buf->switch_deferred, mode + 1);
+		return;
+	}
+
 	/*
 	 * Perform retryable operations.
 	 */
@@ -1901,6 +2147,16 @@ static void _lib_ring_buffer_switch_remote(struct lib_ring_buffer *buf,
 		lib_ring_buffer_switch_slow(buf, mode);
 	}
 	preempt_enable();
+	/*
+	 * The IPI may have interrupted the outermost writer before it
+	 * stored its reservation, in which case the switch is left to that
+	 * writer. It completes it as soon as it leaves its reservation,
+	 * with preemption disabled: wait for it, so callers clearing or
+	 * flushing the buffer never act on a still-open sub-buffer.
+	 */
+	while (READ_ONCE(buf->switch_deferred))
+		cpu_relax();
+	smp_mb();
 }
 
 /* Switch sub-buffer if current sub-buffer is non-empty. */
@@ -2094,6 +2350,80 @@ void lib_ring_buffer_lost_event_too_big(struct channel *chan)
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_lost_event_too_big);
 
+/*
+ * Reserve through the nested cursor, after the reservation the outermost
+ * writer is about to store. Sub-buffer switches cannot be performed from
+ * here, so records which do not fit in the current sub-buffer are lost.
+ */
+static
+int lib_ring_buffer_reserve_nested(struct lib_ring_buffer *buf,
+				   struct lib_ring_buffer_ctx *ctx)
+{
+	struct channel *chan = ctx->chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long nested_old, begin, end;
+	size_t before_hdr_pad;
+
+	do {
+		nested_old = v_read(config, &buf->nested_end);
+		begin = nested_old ? : READ_ONCE(buf->reserve_end);
+
+		ctx->tsc = config->cb.ring_buffer_clock_read(chan);
+		if ((int64_t) ctx->tsc == -EIO)
+			return -EIO;
+		if (last_tsc_overflow(config, buf, ctx->tsc))
+			ctx->rflags |= RING_BUFFER_RFLAG_FULL_TSC;
+
+		ctx->slot_size = config->cb.record_header_size(config, chan,
+						begin, &before_hdr_pad, ctx);
+		ctx->slot_size +=
+			lib_ring_buffer_align(begin + ctx->slot_size,
+					      ctx->largest_align)
+			+ ctx->data_size;
+		if (unlikely(subbuf_offset(begin, chan) + ctx->slot_size
+			     >= chan->backend.subbuf_size)) {
+			v_inc(config, &buf->records_lost_wrap);
+			return -ENOBUFS;
+		}
+		end = begin + ctx->slot_size;
+	} while (unlikely(v_cmpxchg(config, &buf->nested_end, nested_old, end)
+			  != nested_old));
+
+	save_last_tsc(config, buf, ctx->tsc);
+	lib_ring_buffer_clear_noref(config, &buf->backend,
+				    subbuf_index(end - 1, chan));
+
+	ctx->pre_offset = begin;
+	ctx->buf_offset = begin + before_hdr_pad;
+	return 0;
+}
+
+/*
+ * Called by the outermost writer of a RING_BUFFER_RESERVE_CURSOR buffer
+ * after storing its reservation, when nested writers reserved through the
+ * nested cursor or deferred a sub-buffer switch meanwhile.
+ */
+void lib_ring_buffer_nested_complete(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	int deferred;
+
+	lib_ring_buffer_nested_merge(config, buf);
+	deferred = READ_ONCE(buf->switch_deferred);
+	if (deferred) {
+		lib_ring_buffer_switch_slow(buf, deferred - 1);
+		/*
+		 * Clear the flag only once the switch is done: remote
+		 * switch callers wait for it. No switch can be deferred
+		 * again meanwhile, as the reservation is stored.
+		 */
+		smp_mb();
+		WRITE_ONCE(buf->switch_deferred, 0);
+	}
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_nested_complete);
+
 /**
  * lib_ring_buffer_reserve_slow - Atomic slot reservation in a buffer.
  * @ctx: ring buffer context.
@@ -2113,6 +2443,9 @@ int lib_ring_buffer_reserve_slow(struct lib_ring_buffer_ctx *ctx)
 	ctx->buf = buf = get_current_buf(chan, ctx->cpu);
 	offsets.size = 0;
 
+	if (unlikely(lib_ring_buffer_nested_prepare(config, buf)))
+		return lib_ring_buffer_reserve_nested(buf, ctx);
+
 	do {
 		ret = lib_ring_buffer_try_reserve_slow(buf, chan, &offsets,
 						       ctx);
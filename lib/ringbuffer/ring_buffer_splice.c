@@ -126,6 +126,9 @@ static int subbuf_splice_actor(struct file *in,
 	printk_dbg(KERN_DEBUG "SPLICE actor len %zu pos %zd write_pos %ld\n",
 		   len, (ssize_t)*ppos, lib_ring_buffer_get_offset(config, buf));
 
+	/* The pages moved to the pipe are replaced below. */
+	lib_ring_buffer_read_vunmap(&buf->backend);
+
 	for (; spd.nr_pages < nr_pages; spd.nr_pages++) {
 		unsigned int this_len;
 		unsigned long *pfnp, new_pfn;
@@ -276,6 +276,9 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 	case RING_BUFFER_FLUSH_EMPTY:
 		lib_ring_buffer_switch_remote_empty(buf);
 		return 0;
+	case RING_BUFFER_CLEAR:
+		lib_ring_buffer_clear(buf);
+		return 0;
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -305,6 +308,9 @@ EXPORT_SYMBOL_GPL(lib_ring_buffer_ioctl);
  *      RING_BUFFER_GET_MMAP_READ_OFFSET
  *              returns the offset of the subbuffer belonging to the reader.
  *              Should only be used for mmap clients.
+ *	RING_BUFFER_CLEAR
+ *		discards the buffer content up to the current producer
+ *		position, without reallocating the buffer.
  */
 static
 long vfs_lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
@@ -427,6 +433,9 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 	case RING_BUFFER_COMPAT_FLUSH_EMPTY:
 		lib_ring_buffer_switch_remote_empty(buf);
 		return 0;
+	case RING_BUFFER_COMPAT_CLEAR:
+		lib_ring_buffer_clear(buf);
+		return 0;
 	default:
 		return -ENOIOCTLCMD;
 	}
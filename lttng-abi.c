@@ -57,6 +57,7 @@
 #include <lttng-events.h>
 #include <lttng-tracer.h>
 #include <lttng-tp-mempool.h>
+#include <lttng-packet-compress.h>
 #include <lib/ringbuffer/frontend_types.h>
 
 /*
@@ -385,6 +386,22 @@ int lttng_abi_create_channel(struct file *session_file,
 	int chan_fd;
 	int ret = 0;
 
+	if (chan_param->record_index && (channel_type != PER_CPU_CHANNEL
+			|| chan_param->output != LTTNG_KERNEL_MMAP))
+		return -EINVAL;
+	if (channel_type == PER_CPU_CHANNEL && chan_param->memory_budget) {
+		size_t subbuf_size, num_subbuf = chan_param->num_subbuf;
+
+		ret = lib_ring_buffer_budget_geometry(chan_param->memory_budget,
+				1, chan_param->overwrite,
+				chan_param->overwrite
+					&& chan_param->output == LTTNG_KERNEL_MMAP,
+				&subbuf_size, &num_subbuf);
+		if (ret)
+			goto fd_error;
+		chan_param->subbuf_size = subbuf_size;
+		chan_param->num_subbuf = num_subbuf;
+	}
 	chan_fd = lttng_get_unused_fd();
 	if (chan_fd < 0) {
 		ret = chan_fd;
@@ -411,6 +428,11 @@ int lttng_abi_create_channel(struct file *session_file,
 		if (chan_param->output == LTTNG_KERNEL_SPLICE) {
 			transport_name = chan_param->overwrite ?
 				"relay-overwrite" : "relay-discard";
+		} else if (chan_param->output == LTTNG_KERNEL_MMAP
+				&& chan_param->record_index) {
+			transport_name = chan_param->overwrite ?
+				"relay-overwrite-mmap-index" :
+				"relay-discard-mmap-index";
 		} else if (chan_param->output == LTTNG_KERNEL_MMAP) {
 			transport_name = chan_param->overwrite ?
 				"relay-overwrite-mmap" : "relay-discard-mmap";
@@ -484,6 +506,8 @@ fd_error:
  *		Add PID to session tracker
  *	LTTNG_KERNEL_SESSION_UNTRACK_PID
  *		Remove PID from session tracker
+ *	LTTNG_KERNEL_SESSION_SET_CLOCK
+ *		Select the session trace clock, before channel creation
  *
  * The returned channel will be deleted when its file descriptor is closed.
  */
@@ -508,6 +532,8 @@ long lttng_session_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		chan_param.switch_timer_interval = old_chan_param.switch_timer_interval;
 		chan_param.read_timer_interval = old_chan_param.read_timer_interval;
 		chan_param.output = old_chan_param.output;
+		chan_param.memory_budget = 0;
+		chan_param.record_index = 0;
 
 		return lttng_abi_create_channel(file, &chan_param,
 				PER_CPU_CHANNEL);
@@ -548,6 +574,8 @@ long lttng_session_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		chan_param.switch_timer_interval = old_chan_param.switch_timer_interval;
 		chan_param.read_timer_interval = old_chan_param.read_timer_interval;
 		chan_param.output = old_chan_param.output;
+		chan_param.memory_budget = 0;
+		chan_param.record_index = 0;
 
 		return lttng_abi_create_channel(file, &chan_param,
 				METADATA_CHANNEL);
@@ -573,6 +601,8 @@ long lttng_session_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return lttng_session_metadata_regenerate(session);
 	case LTTNG_KERNEL_SESSION_STATEDUMP:
 		return lttng_session_statedump(session);
+	case LTTNG_KERNEL_SESSION_SET_CLOCK:
+		return lttng_session_set_clock(session, (int) arg);
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -707,6 +737,13 @@ long lttng_metadata_ring_buffer_ioctl(struct file *filp,
 
 		return put_u64(stream->version, arg);
 	}
+	case RING_BUFFER_CLEAR:
+	{
+		/*
+		 * Clearing is not allowed for metadata channel.
+		 */
+		return -EPERM;
+	}
 	default:
 		break;
 	}
@@ -784,6 +821,13 @@ long lttng_metadata_ring_buffer_compat_ioctl(struct file *filp,
 
 		return put_u64(stream->version, arg);
 	}
+	case RING_BUFFER_CLEAR:
+	{
+		/*
+		 * Clearing is not allowed for metadata channel.
+		 */
+		return -EPERM;
+	}
 	default:
 		break;
 	}
@@ -1110,6 +1154,11 @@ fd_error:
  *		Enable recording for events in this channel (weak enable)
  *	LTTNG_KERNEL_DISABLE
  *		Disable recording for events in this channel (strong disable)
+ *	LTTNG_KERNEL_CHANNEL_CLEAR
+ *		Discard the data buffered in all streams of this channel
+ *	LTTNG_KERNEL_SYSCALL_MASK_UPDATE
+ *		Enable or disable a set of system call entries and exits
+ *		in a single filter update
  *
  * Channel and event file descriptors also hold a reference on the session.
  */
@@ -1128,7 +1177,7 @@ long lttng_channel_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		struct lttng_kernel_old_event *old_uevent_param;
 		int ret;
 
-		uevent_param = kmalloc(sizeof(struct lttng_kernel_event),
+		uevent_param = kzalloc(sizeof(struct lttng_kernel_event),
 				GFP_KERNEL);
 		if (!uevent_param) {
 			ret = -ENOMEM;
@@ -1270,6 +1319,11 @@ old_ctx_end:
 	case LTTNG_KERNEL_SYSCALL_MASK:
 		return lttng_channel_syscall_mask(channel,
 			(struct lttng_kernel_syscall_mask __user *) arg);
+	case LTTNG_KERNEL_SYSCALL_MASK_UPDATE:
+		return lttng_channel_syscall_mask_update(channel,
+			(struct lttng_kernel_syscall_mask_update __user *) arg);
+	case LTTNG_KERNEL_CHANNEL_CLEAR:
+		return lttng_channel_clear(channel);
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -1491,6 +1545,97 @@ static int put_u64(uint64_t val, unsigned long arg)
 	return put_user(val, (uint64_t __user *) arg);
 }
 
+static long lttng_stream_compressed_packet(struct lib_ring_buffer *buf,
+		unsigned long arg)
+{
+	struct lttng_kernel_compressed_packet __user *upacket =
+		(struct lttng_kernel_compressed_packet __user *) arg;
+	struct lttng_kernel_compressed_packet packet;
+	int ret;
+
+	if (copy_from_user(&packet, upacket, sizeof(packet)))
+		return -EFAULT;
+	ret = lttng_packet_compress(buf, &packet);
+	if (ret && ret != -ENOSPC)
+		return ret;
+	if (copy_to_user(upacket, &packet, sizeof(packet)))
+		return -EFAULT;
+	return ret;
+}
+
+/*
+ * Take a snapshot of the stream positions, and move the snapshot consumed
+ * position forward to the first packet which ends at or after "since".
+ * Using the same "since" value for all streams of a session gives a
+ * time-aligned snapshot of the last part of the trace, bounded by the
+ * time window rather than by the buffer size.
+ *
+ * Packet end timestamps increase along the stream, which allows a binary
+ * search. Each packet header is read while holding the sub-buffer, so
+ * overwrite-mode writers cannot modify it concurrently. Packets which
+ * were overwritten since the snapshot are older than the ones remaining,
+ * and are considered out of the window. A packet which cannot be read
+ * for another reason, e.g. a commit still pending, is retried a few
+ * times, and the search fails with -EAGAIN if it stays unreadable, rather
+ * than guess on which side of the window it lies.
+ */
+#define LTTNG_SNAPSHOT_SINCE_RETRY	10
+
+static long lttng_stream_snapshot_since(struct lib_ring_buffer *buf,
+		uint64_t since)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	const struct lttng_channel_ops *ops = chan->backend.priv_ops;
+	unsigned long consumed, low, high;
+	unsigned int retry = 0;
+	int ret;
+
+	if (buf->get_subbuf)
+		return -EBUSY;
+	ret = lib_ring_buffer_snapshot(buf, &buf->cons_snapshot,
+			&buf->prod_snapshot);
+	if (ret)
+		return ret;
+	consumed = buf->cons_snapshot;
+	low = 0;
+	high = (buf->prod_snapshot - consumed)
+		>> chan->backend.subbuf_size_order;
+	while (low < high) {
+		unsigned long mid = low + ((high - low) >> 1);
+		unsigned long pos = consumed
+			+ (mid << chan->backend.subbuf_size_order);
+		uint64_t ts_end;
+
+		ret = lib_ring_buffer_get_subbuf(buf, pos);
+		if (ret == -EAGAIN) {
+			if ((long) pos - (long) atomic_long_read(&buf->consumed) < 0) {
+				/* Overwritten: older than the remaining packets. */
+				low = mid + 1;
+				continue;
+			}
+			if (retry++ < LTTNG_SNAPSHOT_SINCE_RETRY) {
+				cond_resched();
+				continue;
+			}
+		}
+		if (ret)
+			return ret;
+		retry = 0;
+		ret = ops->timestamp_end(config, buf, &ts_end);
+		lib_ring_buffer_put_subbuf(buf);
+		if (ret < 0)
+			return ret;
+		if (ts_end < since)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	buf->cons_snapshot = consumed
+		+ (low << chan->backend.subbuf_size_order);
+	return 0;
+}
+
 static long lttng_stream_ring_buffer_ioctl(struct file *filp,
 		unsigned int cmd, unsigned long arg)
 {
@@ -1585,6 +1730,28 @@ static long lttng_stream_ring_buffer_ioctl(struct file *filp,
 			goto error;
 		return put_u64(id, arg);
 	}
+	case LTTNG_RING_BUFFER_SNAPSHOT_SINCE:
+	{
+		uint64_t since;
+
+		if (get_user(since, (uint64_t __user *) arg))
+			return -EFAULT;
+		return lttng_stream_snapshot_since(buf, since);
+	}
+	case LTTNG_RING_BUFFER_GET_PACKET_INDEX:
+	{
+		struct lttng_kernel_packet_index index;
+
+		ret = ops->packet_index(config, buf, &index);
+		if (ret < 0)
+			goto error;
+		if (copy_to_user((struct lttng_kernel_packet_index __user *) arg,
+				&index, sizeof(index)))
+			return -EFAULT;
+		return 0;
+	}
+	case LTTNG_RING_BUFFER_GET_COMPRESSED_PACKET:
+		return lttng_stream_compressed_packet(buf, arg);
 	default:
 		return lib_ring_buffer_file_operations.unlocked_ioctl(filp,
 				cmd, arg);
@@ -1689,6 +1856,28 @@ static long lttng_stream_ring_buffer_compat_ioctl(struct file *filp,
 			goto error;
 		return put_u64(id, arg);
 	}
+	case LTTNG_RING_BUFFER_COMPAT_SNAPSHOT_SINCE:
+	{
+		uint64_t since;
+
+		if (get_user(since, (uint64_t __user *) arg))
+			return -EFAULT;
+		return lttng_stream_snapshot_since(buf, since);
+	}
+	case LTTNG_RING_BUFFER_COMPAT_GET_PACKET_INDEX:
+	{
+		struct lttng_kernel_packet_index index;
+
+		ret = ops->packet_index(config, buf, &index);
+		if (ret < 0)
+			goto error;
+		if (copy_to_user((struct lttng_kernel_packet_index __user *) arg,
+				&index, sizeof(index)))
+			return -EFAULT;
+		return 0;
+	}
+	case LTTNG_RING_BUFFER_COMPAT_GET_COMPRESSED_PACKET:
+		return lttng_stream_compressed_packet(buf, arg);
 	default:
 		return lib_ring_buffer_file_operations.compat_ioctl(filp,
 				cmd, arg);
@@ -1699,13 +1888,22 @@ error:
 }
 #endif /* CONFIG_COMPAT */
 
+static int lttng_stream_ring_buffer_release(struct inode *inode,
+		struct file *filp)
+{
+	struct lib_ring_buffer *buf = filp->private_data;
+
+	lttng_packet_compress_release(buf);
+	return lib_ring_buffer_file_operations.release(inode, filp);
+}
+
 static void lttng_stream_override_ring_buffer_fops(void)
 {
 	lttng_stream_ring_buffer_file_operations.owner = THIS_MODULE;
 	lttng_stream_ring_buffer_file_operations.open =
 		lib_ring_buffer_file_operations.open;
 	lttng_stream_ring_buffer_file_operations.release =
-		lib_ring_buffer_file_operations.release;
+		lttng_stream_ring_buffer_release;
 	lttng_stream_ring_buffer_file_operations.poll =
 		lib_ring_buffer_file_operations.poll;
 	lttng_stream_ring_buffer_file_operations.splice_read =
@@ -30,7 +30,7 @@
  * should be increased when an incompatible ABI change is done.
  */
 #define LTTNG_MODULES_ABI_MAJOR_VERSION		2
-#define LTTNG_MODULES_ABI_MINOR_VERSION		3
+#define LTTNG_MODULES_ABI_MINOR_VERSION		4
 
 #define LTTNG_KERNEL_SYM_NAME_LEN	256
 
@@ -62,7 +62,18 @@ struct lttng_kernel_channel {
 	unsigned int read_timer_interval;	/* usecs */
 	enum lttng_kernel_output output;	/* splice, mmap */
 	int overwrite;				/* 1: overwrite, 0: discard */
-	char padding[LTTNG_KERNEL_CHANNEL_PADDING];
+	/*
+	 * Memory for all buffers of the channel, in bytes. When non-zero,
+	 * subbuf_size is derived from it, and num_subbuf is a hint.
+	 */
+	uint64_t memory_budget;
+	/*
+	 * 1: keep a record offset index in each packet context. Only
+	 * available with mmap output.
+	 */
+	uint32_t record_index;
+	char padding[LTTNG_KERNEL_CHANNEL_PADDING - sizeof(uint64_t)
+			- sizeof(uint32_t)];
 } __attribute__((packed));
 
 struct lttng_kernel_kretprobe {
@@ -88,12 +99,18 @@ struct lttng_kernel_function_tracer {
 
 /*
  * For syscall tracing, name = "*" means "enable all".
+ *
+ * field_mask selects which payload fields of tracepoint events are
+ * recorded: bit N selects the N-th field of the event description.
+ * Fields beyond the 64th are always recorded. A zero mask records all
+ * fields.
  */
-#define LTTNG_KERNEL_EVENT_PADDING1	16
+#define LTTNG_KERNEL_EVENT_PADDING1	8
 #define LTTNG_KERNEL_EVENT_PADDING2	LTTNG_KERNEL_SYM_NAME_LEN + 32
 struct lttng_kernel_event {
 	char name[LTTNG_KERNEL_SYM_NAME_LEN];	/* event name */
 	enum lttng_kernel_instrumentation instrumentation;
+	uint64_t field_mask;			/* recorded payload fields */
 	char padding[LTTNG_KERNEL_EVENT_PADDING1];
 
 	/* Per instrumentation type configuration */
@@ -129,6 +146,26 @@ struct lttng_kernel_syscall_mask {
 	char mask[];
 } __attribute__((packed));
 
+enum lttng_kernel_syscall_mask_op {
+	LTTNG_KERNEL_SYSCALL_MASK_ENABLE = 0,
+	LTTNG_KERNEL_SYSCALL_MASK_DISABLE = 1,
+};
+
+/*
+ * Batch update of the channel system call filter. mask holds two
+ * bitmaps of len bits, laid out as for LTTNG_KERNEL_SYSCALL_MASK: the
+ * system call entry bitmap, followed by the exit bitmap, each starting
+ * on a byte boundary. The system calls set in the bitmaps are enabled
+ * or disabled according to op, the others are left unchanged. The mask
+ * acts as one more enabler of the channel system call events: disabling
+ * a system call through it does not override an enabler matching it.
+ */
+struct lttng_kernel_syscall_mask_update {
+	uint32_t len;	/* in bits, of each bitmap */
+	uint32_t op;	/* enum lttng_kernel_syscall_mask_op */
+	char mask[];
+} __attribute__((packed));
+
 enum lttng_kernel_context_type {
 	LTTNG_KERNEL_CONTEXT_PID		= 0,
 	LTTNG_KERNEL_CONTEXT_PERF_COUNTER	= 1,
@@ -166,6 +203,47 @@ struct lttng_kernel_context {
 	} u;
 } __attribute__((packed));
 
+enum lttng_kernel_clock {
+	LTTNG_KERNEL_CLOCK_DEFAULT		= 0,	/* global trace clock */
+	LTTNG_KERNEL_CLOCK_MONOTONIC		= 1,
+	LTTNG_KERNEL_CLOCK_MONOTONIC_RAW	= 2,
+	LTTNG_KERNEL_CLOCK_BOOTTIME		= 3,
+	LTTNG_KERNEL_CLOCK_TSC			= 4,
+};
+
+enum lttng_kernel_compression {
+	LTTNG_KERNEL_COMPRESSION_LZ4		= 0,
+};
+
+/*
+ * Compress the packet currently held by the reader into a user-space
+ * buffer. compressed_size is set even when the buffer is too small
+ * (-ENOSPC), so the consumer can retry with a larger buffer. Only
+ * available on mmap streams.
+ */
+struct lttng_kernel_compressed_packet {
+	uint32_t algorithm;		/* enum lttng_kernel_compression (input) */
+	uint64_t addr;			/* destination address (input) */
+	uint64_t len;			/* destination length, in bytes (input) */
+	uint64_t content_size;		/* packet size before compression (output) */
+	uint64_t compressed_size;	/* packet size after compression (output) */
+} __attribute__((packed));
+
+/*
+ * Packet index entry of the packet currently held by the reader, as
+ * written in the CTF index files. Sizes are in bits.
+ */
+struct lttng_kernel_packet_index {
+	uint64_t timestamp_begin;
+	uint64_t timestamp_end;
+	uint64_t content_size;
+	uint64_t packet_size;
+	uint64_t events_discarded;
+	uint64_t stream_id;
+	uint64_t seq_num;
+	uint64_t stream_instance_id;
+} __attribute__((packed));
+
 #define LTTNG_KERNEL_FILTER_BYTECODE_MAX_LEN		65536
 struct lttng_kernel_filter_bytecode {
 	uint32_t len;
@@ -206,6 +284,8 @@ struct lttng_kernel_filter_bytecode {
 #define LTTNG_KERNEL_SESSION_METADATA_REGEN	_IO(0xF6, 0x59)
 /* 0x5A and 0x5B are reserved for a future ABI-breaking cleanup. */
 #define LTTNG_KERNEL_SESSION_STATEDUMP		_IO(0xF6, 0x5C)
+/* Select the session clock (enum lttng_kernel_clock), before any channel. */
+#define LTTNG_KERNEL_SESSION_SET_CLOCK		_IO(0xF6, 0x5D)
 
 /* Channel FD ioctl */
 #define LTTNG_KERNEL_STREAM			_IO(0xF6, 0x62)
@@ -213,6 +293,9 @@ struct lttng_kernel_filter_bytecode {
 	_IOW(0xF6, 0x63, struct lttng_kernel_event)
 #define LTTNG_KERNEL_SYSCALL_MASK		\
 	_IOWR(0xF6, 0x64, struct lttng_kernel_syscall_mask)
+#define LTTNG_KERNEL_CHANNEL_CLEAR		_IO(0xF6, 0x65)
+#define LTTNG_KERNEL_SYSCALL_MASK_UPDATE	\
+	_IOW(0xF6, 0x66, struct lttng_kernel_syscall_mask_update)
 
 /* Event and Channel FD ioctl */
 #define LTTNG_KERNEL_CONTEXT			\
@@ -244,6 +327,18 @@ struct lttng_kernel_filter_bytecode {
 #define LTTNG_RING_BUFFER_GET_SEQ_NUM		_IOR(0xF6, 0x27, uint64_t)
 /* returns the stream instance id */
 #define LTTNG_RING_BUFFER_INSTANCE_ID		_IOR(0xF6, 0x28, uint64_t)
+/* compresses the current packet into a user-space buffer */
+#define LTTNG_RING_BUFFER_GET_COMPRESSED_PACKET	\
+	_IOWR(0xF6, 0x29, struct lttng_kernel_compressed_packet)
+/* returns all the index fields of the current packet at once */
+#define LTTNG_RING_BUFFER_GET_PACKET_INDEX	\
+	_IOR(0xF6, 0x2A, struct lttng_kernel_packet_index)
+/*
+ * snapshot restricted to the packets ending at or after the given
+ * timestamp (trace clock units). Positions are then retrieved with
+ * RING_BUFFER_SNAPSHOT_GET_CONSUMED/PRODUCED.
+ */
+#define LTTNG_RING_BUFFER_SNAPSHOT_SINCE	_IOW(0xF6, 0x2B, uint64_t)
 
 #ifdef CONFIG_COMPAT
 /* returns the timestamp begin of the current sub-buffer */
@@ -273,6 +368,15 @@ struct lttng_kernel_filter_bytecode {
 /* returns the stream instance id */
 #define LTTNG_RING_BUFFER_COMPAT_INSTANCE_ID	\
 	LTTNG_RING_BUFFER_INSTANCE_ID
+/* compresses the current packet into a user-space buffer */
+#define LTTNG_RING_BUFFER_COMPAT_GET_COMPRESSED_PACKET	\
+	LTTNG_RING_BUFFER_GET_COMPRESSED_PACKET
+/* returns all the index fields of the current packet at once */
+#define LTTNG_RING_BUFFER_COMPAT_GET_PACKET_INDEX	\
+	LTTNG_RING_BUFFER_GET_PACKET_INDEX
+/* snapshot restricted to the packets ending at or after a timestamp */
+#define LTTNG_RING_BUFFER_COMPAT_SNAPSHOT_SINCE	\
+	LTTNG_RING_BUFFER_SNAPSHOT_SINCE
 #endif /* CONFIG_COMPAT */
 
 #endif /* _LTTNG_ABI_H */
@@ -28,7 +28,7 @@
 struct lttng_trace_clock {
 	u64 (*read64)(void);
 	u64 (*freq)(void);
-	int (*uuid)(char *uuid);
+	int (*uuid)(char *uuid);	/* Optional */
 	const char *(*name)(void);
 	const char *(*description)(void);
 };
@@ -46,6 +46,8 @@ int lttng_cpuhp_rb_backend_prepare(unsigned int cpu,
                 struct lttng_cpuhp_node *node);
 int lttng_cpuhp_rb_frontend_dead(unsigned int cpu,
 		struct lttng_cpuhp_node *node);
+int lttng_cpuhp_rb_frontend_prepare(unsigned int cpu,
+		struct lttng_cpuhp_node *node);
 int lttng_cpuhp_rb_frontend_online(unsigned int cpu,
 		struct lttng_cpuhp_node *node);
 int lttng_cpuhp_rb_frontend_offline(unsigned int cpu,
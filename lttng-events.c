@@ -67,7 +67,6 @@ static LIST_HEAD(lttng_transport_list);
 static DEFINE_MUTEX(sessions_mutex);
 static struct kmem_cache *event_cache;
 
-static void lttng_session_lazy_sync_enablers(struct lttng_session *session);
 static void lttng_session_sync_enablers(struct lttng_session *session);
 static void lttng_enabler_destroy(struct lttng_enabler *enabler);
 
@@ -138,6 +137,8 @@ struct lttng_session *lttng_session_create(void)
 	INIT_LIST_HEAD(&session->chan);
 	INIT_LIST_HEAD(&session->events);
 	uuid_le_gen(&session->uuid);
+	session->clock = &lttng_default_trace_clock;
+	INIT_WORK(&session->statedump_work, lttng_statedump_session_work);
 
 	metadata_cache = kzalloc(sizeof(struct lttng_metadata_cache),
 			GFP_KERNEL);
@@ -187,6 +188,8 @@ void lttng_session_destroy(struct lttng_session *session)
 
 	mutex_lock(&sessions_mutex);
 	WRITE_ONCE(session->active, 0);
+	/* A deferred statedump does not take the sessions mutex. */
+	cancel_work_sync(&session->statedump_work);
 	list_for_each_entry(chan, &session->chan, list) {
 		ret = lttng_syscalls_unregister(chan);
 		WARN_ON(ret);
@@ -225,6 +228,29 @@ int lttng_session_statedump(struct lttng_session *session)
 	return ret;
 }
 
+/*
+ * The clock is read by each channel's buffers, and described once in the
+ * metadata: it can only be changed before the first channel is created.
+ */
+int lttng_session_set_clock(struct lttng_session *session, int clock)
+{
+	const struct lttng_trace_clock *ltc;
+	int ret = 0;
+
+	ltc = lttng_trace_clock_get(clock);
+	if (IS_ERR(ltc))
+		return PTR_ERR(ltc);
+	mutex_lock(&sessions_mutex);
+	if (session->been_active || !list_empty(&session->chan)) {
+		ret = -EBUSY;
+		goto end;
+	}
+	session->clock = ltc;
+end:
+	mutex_unlock(&sessions_mutex);
+	return ret;
+}
+
 int lttng_session_enable(struct lttng_session *session)
 {
 	int ret = 0;
@@ -390,6 +416,26 @@ end:
 	return ret;
 }
 
+/*
+ * Discard the data buffered in all streams of a channel, without
+ * reallocating its buffers. Mainly useful for flight recorder (overwrite)
+ * channels, which otherwise keep the old data until it is overwritten.
+ */
+int lttng_channel_clear(struct lttng_channel *channel)
+{
+	int ret = 0;
+
+	mutex_lock(&sessions_mutex);
+	if (channel->channel_type == METADATA_CHANNEL) {
+		ret = -EPERM;
+		goto end;
+	}
+	lib_ring_buffer_clear_channel(channel->chan);
+end:
+	mutex_unlock(&sessions_mutex);
+	return ret;
+}
+
 int lttng_event_enable(struct lttng_event *event)
 {
 	int ret = 0;
@@ -501,6 +547,9 @@ struct lttng_channel *lttng_channel_create(struct lttng_session *session,
 	chan->session = session;
 	chan->id = session->free_chan_id++;
 	chan->ops = &transport->ops;
+	/* The default clock is read inline, without indirect call. */
+	if (session->clock != &lttng_default_trace_clock)
+		chan->clock_read = session->clock->read64;
 	/*
 	 * Note: the channel creation op already writes into the packet
 	 * headers. Therefore the "chan" information used as input
@@ -625,6 +674,12 @@ struct lttng_event *_lttng_event_create(struct lttng_channel *chan,
 	event->id = chan->free_event_id++;
 	event->instrumentation = itype;
 	event->evtype = LTTNG_TYPE_EVENT;
+	/* Only generated tracepoint probes honor field projection. */
+	if (itype == LTTNG_KERNEL_TRACEPOINT && event_param
+			&& event_param->field_mask)
+		event->field_mask = event_param->field_mask;
+	else
+		event->field_mask = LTTNG_EVENT_FIELD_MASK_ALL;
 	INIT_LIST_HEAD(&event->bytecode_runtime_head);
 	INIT_LIST_HEAD(&event->enablers_ref_head);
 
@@ -688,6 +743,7 @@ struct lttng_event *_lttng_event_create(struct lttng_channel *chan,
 		event_return->enabled = 0;
 		event_return->registered = 1;
 		event_return->instrumentation = itype;
+		event_return->field_mask = event->field_mask;
 		/*
 		 * Populate lttng_event structure before kretprobe registration.
 		 */
@@ -759,6 +815,18 @@ struct lttng_event *_lttng_event_create(struct lttng_channel *chan,
 		ret = -EINVAL;
 		goto register_error;
 	}
+	/*
+	 * Filters reading fields computed by TP_code_pre are evaluated
+	 * after it. Probes not describing those fields always do so.
+	 * Not registered yet for tracepoints and syscalls, which are
+	 * the only users.
+	 */
+	if (event->desc->filter_locvar_mask)
+		event->filter_locvar_mask = event->desc->filter_locvar_mask();
+	else
+		event->filter_locvar_mask = LTTNG_EVENT_FIELD_MASK_ALL;
+	event->filter_after_code_pre =
+		(event->filter_locvar_mask == LTTNG_EVENT_FIELD_MASK_ALL);
 	ret = _lttng_event_metadata_statedump(chan->session, chan, event);
 	WARN_ON_ONCE(ret > 0);
 	if (ret) {
@@ -812,8 +880,7 @@ void register_event(struct lttng_event *event)
 						  event);
 		break;
 	case LTTNG_KERNEL_SYSCALL:
-		ret = lttng_syscall_filter_enable(event->chan,
-			desc->name);
+		ret = lttng_syscall_filter_enable(event->chan, event);
 		break;
 	case LTTNG_KERNEL_KPROBE:
 	case LTTNG_KERNEL_KRETPROBE:
@@ -833,13 +900,11 @@ void register_event(struct lttng_event *event)
  */
 int _lttng_event_unregister(struct lttng_event *event)
 {
-	const struct lttng_event_desc *desc;
 	int ret = -EINVAL;
 
 	if (!event->registered)
 		return 0;
 
-	desc = event->desc;
 	switch (event->instrumentation) {
 	case LTTNG_KERNEL_TRACEPOINT:
 		ret = lttng_wrapper_tracepoint_probe_unregister(event->desc->kname,
@@ -859,8 +924,7 @@ int _lttng_event_unregister(struct lttng_event *event)
 		ret = 0;
 		break;
 	case LTTNG_KERNEL_SYSCALL:
-		ret = lttng_syscall_filter_disable(event->chan,
-			desc->name);
+		ret = lttng_syscall_filter_disable(event->chan, event);
 		break;
 	case LTTNG_KERNEL_NOOP:
 		ret = 0;
@@ -1277,7 +1341,7 @@ void lttng_create_tracepoint_if_missing(struct lttng_enabler *enabler)
 			 * event probe.
 			 */
 			event = _lttng_event_create(enabler->chan,
-					NULL, NULL, desc,
+					&enabler->event_param, NULL, desc,
 					LTTNG_KERNEL_TRACEPOINT);
 			if (!event) {
 				printk(KERN_INFO "Unable to create event %s\n",
@@ -1495,8 +1559,12 @@ void lttng_session_sync_enablers(struct lttng_session *session)
 		int enabled = 0, has_enablers_without_bytecode = 0;
 
 		switch (event->instrumentation) {
-		case LTTNG_KERNEL_TRACEPOINT:
 		case LTTNG_KERNEL_SYSCALL:
+			/* The channel system call mask acts as an enabler. */
+			enabled = event->u.syscall.masked;
+			has_enablers_without_bytecode = enabled;
+			/* Fall-through */
+		case LTTNG_KERNEL_TRACEPOINT:
 			/* Enable events */
 			list_for_each_entry(enabler_ref,
 					&event->enablers_ref_head, node) {
@@ -1554,7 +1622,6 @@ void lttng_session_sync_enablers(struct lttng_session *session)
  * "lazy" sync means we only sync if required.
  * Should be called with sessions mutex held.
  */
-static
 void lttng_session_lazy_sync_enablers(struct lttng_session *session)
 {
 	/* We can skip if session is not active */
@@ -2207,12 +2274,18 @@ int _lttng_fields_metadata_statedump(struct lttng_session *session,
 				   struct lttng_event *event)
 {
 	const struct lttng_event_desc *desc = event->desc;
+	unsigned int field_index = 0;
 	int ret = 0;
 	int i;
 
 	for (i = 0; i < desc->nr_fields; i++) {
 		const struct lttng_event_field *field = &desc->fields[i];
 
+		/* Only describe the fields the probe actually records. */
+		if (!field->nowrite
+				&& !lttng_event_field_selected(event->field_mask,
+					field_index++))
+			continue;
 		ret = _lttng_field_statedump(session, field, 2);
 		if (ret)
 			return ret;
@@ -2308,10 +2381,12 @@ int _lttng_channel_metadata_statedump(struct lttng_session *session,
 		"stream {\n"
 		"	id = %u;\n"
 		"	event.header := %s;\n"
-		"	packet.context := struct packet_context;\n",
+		"	packet.context := struct %s;\n",
 		chan->id,
 		chan->header_type == 1 ? "struct event_header_compact" :
-			"struct event_header_large");
+			"struct event_header_large",
+		chan->transport->record_index_len ?
+			"packet_context_record_index" : "packet_context");
 	if (ret)
 		goto end;
 
@@ -2355,6 +2430,17 @@ int _lttng_stream_packet_context_declare(struct lttng_session *session)
 		"	unsigned long events_discarded;\n"
 		"	uint32_t cpu_id;\n"
 		"};\n\n"
+		"struct packet_context_record_index {\n"
+		"	uint64_clock_monotonic_t timestamp_begin;\n"
+		"	uint64_clock_monotonic_t timestamp_end;\n"
+		"	uint64_t content_size;\n"
+		"	uint64_t packet_size;\n"
+		"	uint64_t packet_seq_num;\n"
+		"	unsigned long events_discarded;\n"
+		"	uint32_t cpu_id;\n"
+		"	uint32_t record_index[%u];\n"
+		"};\n\n",
+		LTTNG_PACKET_RECORD_INDEX_LEN
 		);
 }
 
@@ -2412,19 +2498,19 @@ int _lttng_event_header_declare(struct lttng_session *session)
  * system sets the REALTIME clock to 0 after boot.
  */
 static
-int64_t measure_clock_offset(void)
+int64_t measure_clock_offset(const struct lttng_trace_clock *ltc)
 {
 	uint64_t monotonic_avg, monotonic[2], realtime;
-	uint64_t tcf = trace_clock_freq();
+	uint64_t tcf = ltc->freq();
 	int64_t offset;
 	struct timespec rts = { 0, 0 };
 	unsigned long flags;
 
 	/* Disable interrupts to increase correlation precision. */
 	local_irq_save(flags);
-	monotonic[0] = trace_clock_read64();
+	monotonic[0] = ltc->read64();
 	getnstimeofday(&rts);
-	monotonic[1] = trace_clock_read64();
+	monotonic[1] = ltc->read64();
 	local_irq_restore(flags);
 
 	monotonic_avg = (monotonic[0] + monotonic[1]) >> 1;
@@ -2531,12 +2617,12 @@ int _lttng_session_metadata_statedump(struct lttng_session *session)
 	ret = lttng_metadata_printf(session,
 		"clock {\n"
 		"	name = \"%s\";\n",
-		trace_clock_name()
+		session->clock->name()
 		);
 	if (ret)
 		goto end;
 
-	if (!trace_clock_uuid(clock_uuid_s)) {
+	if (session->clock->uuid && !session->clock->uuid(clock_uuid_s)) {
 		ret = lttng_metadata_printf(session,
 			"	uuid = \"%s\";\n",
 			clock_uuid_s
@@ -2551,9 +2637,9 @@ int _lttng_session_metadata_statedump(struct lttng_session *session)
 		"	/* clock value offset from Epoch is: offset * (1/freq) */\n"
 		"	offset = %lld;\n"
 		"};\n\n",
-		trace_clock_description(),
-		(unsigned long long) trace_clock_freq(),
-		(long long) measure_clock_offset()
+		session->clock->description(),
+		(unsigned long long) session->clock->freq(),
+		(long long) measure_clock_offset(session->clock)
 		);
 	if (ret)
 		goto end;
@@ -2573,11 +2659,11 @@ int _lttng_session_metadata_statedump(struct lttng_session *session)
 		"	size = 64; align = %u; signed = false;\n"
 		"	map = clock.%s.value;\n"
 		"} := uint64_clock_monotonic_t;\n\n",
-		trace_clock_name(),
+		session->clock->name(),
 		lttng_alignof(uint32_t) * CHAR_BIT,
-		trace_clock_name(),
+		session->clock->name(),
 		lttng_alignof(uint64_t) * CHAR_BIT,
-		trace_clock_name()
+		session->clock->name()
 		);
 	if (ret)
 		goto end;
@@ -2658,7 +2744,7 @@ static int lttng_hotplug_prepare(unsigned int cpu, struct hlist_node *node)
 	lttng_node = container_of(node, struct lttng_cpuhp_node, node);
 	switch (lttng_node->component) {
 	case LTTNG_RING_BUFFER_FRONTEND:
-		return 0;
+		return lttng_cpuhp_rb_frontend_prepare(cpu, lttng_node);
 	case LTTNG_RING_BUFFER_BACKEND:
 		return lttng_cpuhp_rb_backend_prepare(cpu, lttng_node);
 	case LTTNG_RING_BUFFER_ITER:
@@ -27,8 +27,10 @@
 #include <linux/list.h>
 #include <linux/kprobes.h>
 #include <linux/kref.h>
+#include <linux/workqueue.h>
 #include <lttng-cpuhotplug.h>
 #include <wrapper/uuid.h>
+#include <wrapper/rcu.h>
 #include <lttng-tracer.h>
 #include <lttng-abi.h>
 #include <lttng-abi-old.h>
@@ -231,6 +233,8 @@ struct lttng_event_desc {
 	const struct lttng_event_field *fields;	/* event payload */
 	unsigned int nr_fields;
 	struct module *owner;
+	/* Fields computed from TP_locvar, or NULL if unknown */
+	uint64_t (*filter_locvar_mask)(void);
 };
 
 struct lttng_probe_desc {
@@ -274,6 +278,7 @@ struct lttng_bytecode_runtime {
 	uint64_t (*filter)(void *filter_data, struct lttng_probe_ctx *lttng_probe_ctx,
 			const char *filter_stack_data);
 	int link_failed;
+	uint64_t field_mask;	/* fields read by the bytecode */
 	struct list_head node;	/* list of bytecode runtime in event */
 };
 
@@ -310,6 +315,10 @@ struct lttng_event {
 		struct {
 			char *symbol_name;
 		} ftrace;
+		struct {
+			unsigned int index;	/* Channel dispatch table slot */
+			unsigned int masked:1;	/* Enabled by the channel mask */
+		} syscall;
 	} u;
 	struct list_head list;		/* Event list in session */
 	unsigned int metadata_dumped:1;
@@ -321,8 +330,58 @@ struct lttng_event {
 	/* list of struct lttng_bytecode_runtime, sorted by seqnum */
 	struct list_head bytecode_runtime_head;
 	int has_enablers_without_bytecode;
+	uint64_t field_mask;		/* recorded payload fields */
+	uint64_t filter_field_mask;	/* fields read by filter bytecode */
+	uint64_t filter_locvar_mask;	/* fields computed by TP_code_pre */
+	int filter_after_code_pre;	/* filters read filter_locvar_mask */
 };
 
+/*
+ * Payload field projection. Bit N of the event field mask selects the
+ * N-th written field of the event description (nowrite fields are not
+ * counted). Fields past the mask width are always recorded.
+ *
+ * The filter field mask uses the same helper, indexed by position in the
+ * event description (nowrite fields included), to only prepare the
+ * filter stack slots read by the attached bytecodes. As long as none of
+ * those fields is computed from TP_locvar (filter locvar mask), the
+ * filters are evaluated before the event TP_code_pre code.
+ */
+#define LTTNG_EVENT_FIELD_MASK_BITS	64
+#define LTTNG_EVENT_FIELD_MASK_ALL	(~0ULL)
+
+static inline
+int lttng_event_field_selected(uint64_t field_mask, unsigned int index)
+{
+	if (index >= LTTNG_EVENT_FIELD_MASK_BITS)
+		return 1;
+	return !!(field_mask & (1ULL << index));
+}
+
+/*
+ * Evaluate the filters attached to an event, with the filter stack
+ * prepared for the fields of prepared_mask. Bytecode linked after the
+ * mask was read may need other fields: it is skipped for this hit, as
+ * if it was not linked yet.
+ */
+static inline
+int lttng_event_filter_record(struct lttng_event *event,
+		struct lttng_probe_ctx *lttng_probe_ctx,
+		const char *filter_stack_data, uint64_t prepared_mask)
+{
+	struct lttng_bytecode_runtime *bc_runtime;
+	int record = event->has_enablers_without_bytecode;
+
+	lttng_list_for_each_entry_rcu(bc_runtime, &event->bytecode_runtime_head, node) {
+		if (unlikely(bc_runtime->field_mask & ~prepared_mask))
+			continue;
+		if (unlikely(bc_runtime->filter(bc_runtime, lttng_probe_ctx,
+				filter_stack_data) & LTTNG_FILTER_RECORD_FLAG))
+			record = 1;
+	}
+	return record;
+}
+
 enum lttng_enabler_type {
 	LTTNG_ENABLER_STAR_GLOB,
 	LTTNG_ENABLER_NAME,
@@ -408,16 +467,25 @@ struct lttng_channel_ops {
 	int (*instance_id) (const struct lib_ring_buffer_config *config,
 			struct lib_ring_buffer *bufb,
 			uint64_t *id);
+	int (*packet_index) (const struct lib_ring_buffer_config *config,
+			struct lib_ring_buffer *bufb,
+			struct lttng_kernel_packet_index *index);
 };
 
+/* Number of record offset slots in packet contexts with a record index. */
+#define LTTNG_PACKET_RECORD_INDEX_LEN	32
+
 struct lttng_transport {
 	char *name;
 	struct module *owner;
 	struct list_head node;
+	unsigned int record_index_len;	/* 0 if packets have no record index */
 	struct lttng_channel_ops ops;
 };
 
 struct lttng_syscall_filter;
+struct lttng_syscall_dispatch;
+struct lttng_syscall_stash;
 
 #define LTTNG_EVENT_HT_BITS		12
 #define LTTNG_EVENT_HT_SIZE		(1U << LTTNG_EVENT_HT_BITS)
@@ -438,17 +506,12 @@ struct lttng_channel {
 	struct list_head list;		/* Channel list */
 	struct lttng_channel_ops *ops;
 	struct lttng_transport *transport;
-	struct lttng_event **sc_table;	/* for syscall tracing */
-	struct lttng_event **compat_sc_table;
-	struct lttng_event **sc_exit_table;	/* for syscall exit tracing */
-	struct lttng_event **compat_sc_exit_table;
-	struct lttng_event *sc_unknown;	/* for unknown syscalls */
-	struct lttng_event *sc_compat_unknown;
-	struct lttng_event *sc_exit_unknown;
-	struct lttng_event *compat_sc_exit_unknown;
+	struct lttng_syscall_dispatch *sc_dispatch;	/* for syscall tracing */
+	struct lttng_syscall_stash *sc_stash;	/* syscall entry arguments */
 	struct lttng_syscall_filter *sc_filter;
 	int header_type;		/* 0: unset, 1: compact, 2: large */
 	enum channel_type channel_type;
+	u64 (*clock_read)(void);	/* Session clock, NULL for default */
 	unsigned int metadata_dumped:1,
 		sys_enter_registered:1,
 		sys_exit_registered:1,
@@ -504,12 +567,14 @@ struct lttng_session {
 	uuid_le uuid;			/* Trace session unique ID */
 	struct lttng_metadata_cache *metadata_cache;
 	struct lttng_pid_tracker *pid_tracker;
+	const struct lttng_trace_clock *clock;	/* Session trace clock */
 	unsigned int metadata_dumped:1,
 		tstate:1;		/* Transient enable state */
 	/* List of enablers */
 	struct list_head enablers_head;
 	/* Hash table of events */
 	struct lttng_event_ht events_ht;
+	struct work_struct statedump_work;	/* Rate-capped statedump */
 };
 
 struct lttng_metadata_cache {
@@ -536,6 +601,7 @@ int lttng_enabler_enable(struct lttng_enabler *enabler);
 int lttng_enabler_disable(struct lttng_enabler *enabler);
 int lttng_fix_pending_events(void);
 int lttng_session_active(void);
+void lttng_session_lazy_sync_enablers(struct lttng_session *session);
 
 struct lttng_session *lttng_session_create(void);
 int lttng_session_enable(struct lttng_session *session);
@@ -543,6 +609,7 @@ int lttng_session_disable(struct lttng_session *session);
 void lttng_session_destroy(struct lttng_session *session);
 int lttng_session_metadata_regenerate(struct lttng_session *session);
 int lttng_session_statedump(struct lttng_session *session);
+int lttng_session_set_clock(struct lttng_session *session, int clock);
 void metadata_cache_destroy(struct kref *kref);
 
 struct lttng_channel *lttng_channel_create(struct lttng_session *session,
@@ -576,6 +643,7 @@ struct lttng_event *lttng_event_compat_old_create(struct lttng_channel *chan,
 
 int lttng_channel_enable(struct lttng_channel *channel);
 int lttng_channel_disable(struct lttng_channel *channel);
+int lttng_channel_clear(struct lttng_channel *channel);
 int lttng_event_enable(struct lttng_event *event);
 int lttng_event_disable(struct lttng_event *event);
 
@@ -617,11 +685,13 @@ void lttng_clock_unref(void);
 int lttng_syscalls_register(struct lttng_channel *chan, void *filter);
 int lttng_syscalls_unregister(struct lttng_channel *chan);
 int lttng_syscall_filter_enable(struct lttng_channel *chan,
-		const char *name);
+		struct lttng_event *event);
 int lttng_syscall_filter_disable(struct lttng_channel *chan,
-		const char *name);
+		struct lttng_event *event);
 long lttng_channel_syscall_mask(struct lttng_channel *channel,
 		struct lttng_kernel_syscall_mask __user *usyscall_mask);
+long lttng_channel_syscall_mask_update(struct lttng_channel *channel,
+		struct lttng_kernel_syscall_mask_update __user *uupdate);
 #else
 static inline int lttng_syscalls_register(struct lttng_channel *chan, void *filter)
 {
@@ -634,13 +704,13 @@ static inline int lttng_syscalls_unregister(struct lttng_channel *chan)
 }
 
 static inline int lttng_syscall_filter_enable(struct lttng_channel *chan,
-		const char *name)
+		struct lttng_event *event)
 {
 	return -ENOSYS;
 }
 
 static inline int lttng_syscall_filter_disable(struct lttng_channel *chan,
-		const char *name)
+		struct lttng_event *event)
 {
 	return -ENOSYS;
 }
@@ -650,6 +720,12 @@ static inline long lttng_channel_syscall_mask(struct lttng_channel *channel,
 {
 	return -ENOSYS;
 }
+
+static inline long lttng_channel_syscall_mask_update(struct lttng_channel *channel,
+		struct lttng_kernel_syscall_mask_update __user *uupdate)
+{
+	return -ENOSYS;
+}
 #endif
 
 void lttng_filter_sync_state(struct lttng_bytecode_runtime *runtime);
@@ -738,6 +814,7 @@ int lttng_logger_init(void);
 void lttng_logger_exit(void);
 
 extern int lttng_statedump_start(struct lttng_session *session);
+void lttng_statedump_session_work(struct work_struct *work);
 
 #ifdef CONFIG_KPROBES
 int lttng_kprobes_register(const char *name,
@@ -25,6 +25,8 @@
  */
 
 #include <linux/uaccess.h>
+#include <linux/swab.h>
+#include <linux/percpu.h>
 #include <wrapper/frame.h>
 #include <wrapper/types.h>
 
@@ -93,6 +95,138 @@ char get_char_at_cb(size_t at, void *data)
 	return get_char(data, at);
 }
 
+/*
+ * Load an integer element of an array or sequence field, sign or zero
+ * extended to 64-bit. Out of bound indexes and faulting user-space
+ * reads are reported as errors.
+ */
+static
+int load_field_index_s64(const struct filter_index_ref *index_ref,
+		const char *filter_stack_data, int64_t *v)
+{
+	union {
+		int8_t s8;
+		int16_t s16;
+		int32_t s32;
+		int64_t s64;
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+		uint64_t u64;
+		char c[sizeof(uint64_t)];
+	} elem;
+	unsigned long len;
+	const char *ptr;
+
+	len = *(unsigned long *) &filter_stack_data[index_ref->offset];
+	ptr = *(const char **) (&filter_stack_data[index_ref->offset
+						+ sizeof(unsigned long)]);
+	if (unlikely(!ptr || index_ref->index >= len))
+		return -EINVAL;
+	ptr += index_ref->index * index_ref->elem_size;
+	if (index_ref->user) {
+		const char __user *uptr = (const char __user *) ptr;
+		mm_segment_t old_fs;
+		int fault = 0;
+
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		pagefault_disable();
+		if (unlikely(!access_ok(VERIFY_READ, uptr,
+				index_ref->elem_size))
+				|| __copy_from_user_inatomic(elem.c, uptr,
+					index_ref->elem_size))
+			fault = 1;
+		pagefault_enable();
+		set_fs(old_fs);
+		if (unlikely(fault))
+			return -EFAULT;
+	} else {
+		memcpy(elem.c, ptr, index_ref->elem_size);
+	}
+	switch (index_ref->elem_size) {
+	case 1:
+		*v = index_ref->signedness ? elem.s8 : elem.u8;
+		break;
+	case 2:
+		if (index_ref->reverse_byte_order)
+			__swab16s(&elem.u16);
+		*v = index_ref->signedness ? elem.s16 : elem.u16;
+		break;
+	case 4:
+		if (index_ref->reverse_byte_order)
+			__swab32s(&elem.u32);
+		*v = index_ref->signedness ? elem.s32 : elem.u32;
+		break;
+	case 8:
+		if (index_ref->reverse_byte_order)
+			__swab64s(&elem.u64);
+		*v = elem.s64;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Compare a candidate string with a precompiled literal. Returns the
+ * sign of the candidate minus the literal, with the same semantic as
+ * stack_strcmp(). Should be called with page fault handler disabled if
+ * the candidate is a user-space string.
+ */
+static
+int matcher_strcmp(const struct filter_str_matcher *matcher,
+		struct estack_entry *candidate)
+{
+	size_t i;
+
+	for (i = 0; i < matcher->len; i++) {
+		char c = get_char(candidate, i);
+
+		if (unlikely(c == '\0'))
+			return -1;
+		if (c != matcher->str[i])
+			return c - matcher->str[i];
+	}
+	if (matcher->type == FILTER_STR_MATCH_PREFIX)
+		return 0;
+	return get_char(candidate, i) != '\0';
+}
+
+/*
+ * Match a candidate string against a precompiled globbing pattern.
+ * Should be called with page fault handler disabled if the candidate
+ * is a user-space string.
+ */
+static
+bool matcher_glob_match(const struct filter_str_matcher *matcher,
+		struct estack_entry *candidate)
+{
+	size_t i, candidate_len;
+
+	switch (matcher->type) {
+	case FILTER_STR_MATCH_LITERAL:
+	case FILTER_STR_MATCH_PREFIX:
+		return matcher_strcmp(matcher, candidate) == 0;
+	case FILTER_STR_MATCH_SUFFIX:
+		for (candidate_len = 0; get_char(candidate, candidate_len) != '\0';
+				candidate_len++)
+			;
+		if (candidate_len < matcher->len)
+			return false;
+		for (i = 0; i < matcher->len; i++) {
+			if (get_char(candidate, candidate_len - matcher->len + i)
+					!= matcher->str[i])
+				return false;
+		}
+		return true;
+	default:
+		WARN_ON_ONCE(1);
+		return false;
+	}
+}
+
 static
 int stack_star_glob_match(struct estack *stack, int top, const char *cmp_type)
 {
@@ -120,8 +254,13 @@ int stack_star_glob_match(struct estack *stack, int top, const char *cmp_type)
 	}
 
 	/* Perform the match operation. */
-	result = !strutils_star_glob_match_char_cb(get_char_at_cb,
-		pattern_reg, get_char_at_cb, candidate_reg);
+	if (pattern_reg->u.s.matcher
+			&& candidate_reg->u.s.literal_type == ESTACK_STRING_LITERAL_TYPE_NONE)
+		result = !matcher_glob_match(pattern_reg->u.s.matcher,
+			candidate_reg);
+	else
+		result = !strutils_star_glob_match_char_cb(get_char_at_cb,
+			pattern_reg, get_char_at_cb, candidate_reg);
 	if (has_user) {
 		pagefault_enable();
 		set_fs(old_fs);
@@ -145,6 +284,22 @@ int stack_strcmp(struct estack *stack, int top, const char *cmp_type)
 		pagefault_disable();
 	}
 
+	/* Precompiled literal compared with a non-literal string. */
+	if (estack_ax(stack, top)->u.s.literal_type != ESTACK_STRING_LITERAL_TYPE_NONE
+			&& estack_ax(stack, top)->u.s.matcher
+			&& estack_bx(stack, top)->u.s.literal_type == ESTACK_STRING_LITERAL_TYPE_NONE) {
+		diff = matcher_strcmp(estack_ax(stack, top)->u.s.matcher,
+			estack_bx(stack, top));
+		goto end;
+	}
+	if (estack_bx(stack, top)->u.s.literal_type != ESTACK_STRING_LITERAL_TYPE_NONE
+			&& estack_bx(stack, top)->u.s.matcher
+			&& estack_ax(stack, top)->u.s.literal_type == ESTACK_STRING_LITERAL_TYPE_NONE) {
+		diff = -matcher_strcmp(estack_bx(stack, top)->u.s.matcher,
+			estack_ax(stack, top));
+		goto end;
+	}
+
 	for (;;) {
 		int ret;
 		int escaped_r0 = 0;
@@ -226,6 +381,7 @@ int stack_strcmp(struct estack *stack, int top, const char *cmp_type)
 		offset_bx++;
 		offset_ax++;
 	}
+end:
 	if (has_user) {
 		pagefault_enable();
 		set_fs(old_fs);
@@ -299,6 +455,8 @@ uint64_t lttng_filter_interpret_bytecode(void *filter_data,
 	void *pc, *next_pc, *start_pc;
 	int ret = -EINVAL;
 	uint64_t retval = 0;
+	struct estack_entry estack_entries[FILTER_STACK_LEN];
+	struct filter_deep_stack *deep_stack = NULL;
 	struct estack _stack;
 	struct estack *stack = &_stack;
 	register int64_t ax = 0, bx = 0;
@@ -414,9 +572,35 @@ uint64_t lttng_filter_interpret_bytecode(void *filter_data,
 		/* load userspace field ref */
 		[ FILTER_OP_LOAD_FIELD_REF_USER_STRING ] = &&LABEL_FILTER_OP_LOAD_FIELD_REF_USER_STRING,
 		[ FILTER_OP_LOAD_FIELD_REF_USER_SEQUENCE ] = &&LABEL_FILTER_OP_LOAD_FIELD_REF_USER_SEQUENCE,
+
+		/* load array or sequence element */
+		[ FILTER_OP_LOAD_FIELD_REF_INDEX_S64 ] = &&LABEL_FILTER_OP_LOAD_FIELD_REF_INDEX_S64,
+
+		/* s64 set membership and range tests */
+		[ FILTER_OP_IN_SET_S64 ] = &&LABEL_FILTER_OP_IN_SET_S64,
+		[ FILTER_OP_IN_RANGE_S64 ] = &&LABEL_FILTER_OP_IN_RANGE_S64,
+
+		/* precompiled string literal */
+		[ FILTER_OP_LOAD_STRING_MATCHER ] = &&LABEL_FILTER_OP_LOAD_STRING_MATCHER,
 	};
 #endif /* #ifndef INTERPRETER_USE_SWITCH */
 
+	if (likely(!bytecode->deep_stack)) {
+		stack->e = estack_entries;
+		stack->len = FILTER_STACK_LEN;
+	} else {
+		int nesting;
+
+		/* Called with preemption disabled. */
+		deep_stack = this_cpu_ptr(bytecode->deep_stack);
+		nesting = ++deep_stack->nesting;
+		barrier();
+		if (unlikely(nesting > FILTER_STACK_NESTING))
+			goto end;
+		stack->e = deep_stack->e[nesting - 1];
+		stack->len = FILTER_MAX_STACK_LEN;
+	}
+
 	START_OP
 
 		OP(FILTER_OP_UNKNOWN):
@@ -674,6 +858,41 @@ uint64_t lttng_filter_interpret_bytecode(void *filter_data,
 			PO;
 		}
 
+		/* s64 set membership and range tests */
+		OP(FILTER_OP_IN_SET_S64):
+		{
+			struct set_op *insn = (struct set_op *) pc;
+			int lo = 0, hi = insn->nr_values - 1, res = 0;
+
+			/* Values are sorted: binary search. */
+			while (lo <= hi) {
+				int mid = lo + ((hi - lo) >> 1);
+				int64_t v = insn->values[mid];
+
+				if (v == estack_ax_v) {
+					res = 1;
+					break;
+				} else if (v < estack_ax_v) {
+					lo = mid + 1;
+				} else {
+					hi = mid - 1;
+				}
+			}
+			estack_ax_v = res;
+			next_pc += sizeof(struct set_op)
+					+ insn->nr_values * sizeof(int64_t);
+			PO;
+		}
+		OP(FILTER_OP_IN_RANGE_S64):
+		{
+			struct range_op *insn = (struct range_op *) pc;
+
+			estack_ax_v = (estack_ax_v >= insn->lo
+					&& estack_ax_v <= insn->hi);
+			next_pc += sizeof(struct range_op);
+			PO;
+		}
+
 		/* logical */
 		OP(FILTER_OP_AND):
 		{
@@ -794,6 +1013,7 @@ uint64_t lttng_filter_interpret_bytecode(void *filter_data,
 			estack_ax(stack, top)->u.s.seq_len = LTTNG_SIZE_MAX;
 			estack_ax(stack, top)->u.s.literal_type =
 				ESTACK_STRING_LITERAL_TYPE_PLAIN;
+			estack_ax(stack, top)->u.s.matcher = NULL;
 			estack_ax(stack, top)->u.s.user = 0;
 			next_pc += sizeof(struct load_op) + strlen(insn->data) + 1;
 			PO;
@@ -809,11 +1029,30 @@ uint64_t lttng_filter_interpret_bytecode(void *filter_data,
 			estack_ax(stack, top)->u.s.seq_len = LTTNG_SIZE_MAX;
 			estack_ax(stack, top)->u.s.literal_type =
 				ESTACK_STRING_LITERAL_TYPE_STAR_GLOB;
+			estack_ax(stack, top)->u.s.matcher = NULL;
 			estack_ax(stack, top)->u.s.user = 0;
 			next_pc += sizeof(struct load_op) + strlen(insn->data) + 1;
 			PO;
 		}
 
+		OP(FILTER_OP_LOAD_STRING_MATCHER):
+		{
+			struct load_op *insn = (struct load_op *) pc;
+			const struct filter_str_matcher *matcher =
+				&bytecode->matchers[(uint8_t) insn->data[0]];
+
+			dbg_printk("load string matcher %s\n", matcher->pattern);
+			estack_push(stack, top, ax, bx);
+			estack_ax(stack, top)->u.s.str = matcher->pattern;
+			estack_ax(stack, top)->u.s.seq_len = LTTNG_SIZE_MAX;
+			estack_ax(stack, top)->u.s.literal_type =
+				matcher->literal_type;
+			estack_ax(stack, top)->u.s.matcher = matcher;
+			estack_ax(stack, top)->u.s.user = 0;
+			next_pc += matcher->insn_len;
+			PO;
+		}
+
 		OP(FILTER_OP_LOAD_S64):
 		{
 			struct load_op *insn = (struct load_op *) pc;
@@ -955,8 +1194,35 @@ uint64_t lttng_filter_interpret_bytecode(void *filter_data,
 			PO;
 		}
 
+		/* load array or sequence element */
+		OP(FILTER_OP_LOAD_FIELD_REF_INDEX_S64):
+		{
+			struct load_op *insn = (struct load_op *) pc;
+			struct field_ref *ref = (struct field_ref *) insn->data;
+			int64_t v;
+
+			dbg_printk("load field ref index %u type s64\n",
+				ref->offset);
+			ret = load_field_index_s64(&bytecode->index_refs[ref->offset],
+				filter_stack_data, &v);
+			if (unlikely(ret)) {
+				dbg_printk("Filter warning: cannot load element.\n");
+				goto end;
+			}
+			estack_push(stack, top, ax, bx);
+			estack_ax_v = v;
+			dbg_printk("ref load index s64 %lld\n",
+				(long long) estack_ax_v);
+			next_pc += sizeof(struct load_op) + sizeof(struct field_ref);
+			PO;
+		}
+
 	END_OP
 end:
+	if (deep_stack) {
+		barrier();
+		deep_stack->nesting--;
+	}
 	/* return 0 (discard) on error */
 	if (ret)
 		return 0;
@@ -24,8 +24,118 @@
  * SOFTWARE.
  */
 
+#include <linux/slab.h>
 #include <lttng-filter.h>
 
+/*
+ * Resolve the escape sequences of a string literal, following the
+ * semantic of stack_strcmp() for plain literals and of
+ * strutils_star_glob_match_char_cb() for globbing patterns. Anything
+ * else than a literal, a single trailing star, or (for globbing
+ * patterns) a single leading star is left to the generic comparator.
+ */
+static
+enum filter_str_match_type compile_string_literal(const char *pattern,
+		enum estack_string_literal_type literal_type,
+		char *str, size_t *len)
+{
+	enum filter_str_match_type type = FILTER_STR_MATCH_LITERAL;
+	const char *p = pattern;
+	size_t pos = 0;
+
+	if (literal_type == ESTACK_STRING_LITERAL_TYPE_STAR_GLOB
+			&& *p == '*') {
+		type = FILTER_STR_MATCH_SUFFIX;
+		p++;
+	}
+	for (; *p != '\0'; p++) {
+		switch (*p) {
+		case '*':
+			if (literal_type == ESTACK_STRING_LITERAL_TYPE_PLAIN) {
+				/* Anything after the star is ignored. */
+				type = FILTER_STR_MATCH_PREFIX;
+				goto end;
+			}
+			if (type != FILTER_STR_MATCH_LITERAL || p[1] != '\0')
+				return FILTER_STR_MATCH_GENERIC;
+			type = FILTER_STR_MATCH_PREFIX;
+			goto end;
+		case '\\':
+			p++;
+			if (*p == '\0')
+				return FILTER_STR_MATCH_GENERIC;
+			if (literal_type == ESTACK_STRING_LITERAL_TYPE_PLAIN
+					&& *p != '\\' && *p != '*')
+				return FILTER_STR_MATCH_GENERIC;
+			/* Fall-through */
+		default:
+			str[pos++] = *p;
+			break;
+		}
+	}
+end:
+	str[pos] = '\0';
+	*len = pos;
+	return type;
+}
+
+/*
+ * Replace a string literal load by a load of its precompiled matcher.
+ * The first byte of the operand is overwritten with the matcher index,
+ * the original operand being kept in the matcher. Literals which do not
+ * benefit from precompilation are left untouched.
+ */
+static
+int specialize_string_literal(struct bytecode_runtime *bytecode,
+		struct load_op *insn,
+		enum estack_string_literal_type literal_type)
+{
+	struct filter_str_matcher *matcher, *new_matchers;
+	size_t len = strlen(insn->data);
+	enum filter_str_match_type type;
+	char *buf;
+
+	if (bytecode->nr_matchers >= FILTER_MAX_STRING_MATCHERS)
+		return 0;
+	buf = kmalloc(2 * (len + 1), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	memcpy(buf, insn->data, len + 1);
+	type = compile_string_literal(buf, literal_type,
+			buf + len + 1, &len);
+	if (type == FILTER_STR_MATCH_GENERIC) {
+		kfree(buf);
+		return 0;
+	}
+	new_matchers = krealloc(bytecode->matchers,
+			(bytecode->nr_matchers + 1) * sizeof(*new_matchers),
+			GFP_KERNEL);
+	if (!new_matchers) {
+		kfree(buf);
+		return -ENOMEM;
+	}
+	bytecode->matchers = new_matchers;
+	matcher = &bytecode->matchers[bytecode->nr_matchers];
+	matcher->type = type;
+	matcher->literal_type = literal_type;
+	matcher->pattern = buf;
+	matcher->str = buf + strlen(buf) + 1;
+	matcher->len = len;
+	matcher->insn_len = sizeof(struct load_op) + strlen(insn->data) + 1;
+	insn->op = FILTER_OP_LOAD_STRING_MATCHER;
+	insn->data[0] = (char) bytecode->nr_matchers++;
+	return 0;
+}
+
+void lttng_filter_free_string_matchers(struct bytecode_runtime *bytecode)
+{
+	unsigned int i;
+
+	for (i = 0; i < bytecode->nr_matchers; i++)
+		kfree(bytecode->matchers[i].pattern);
+	kfree(bytecode->matchers);
+}
+
 int lttng_filter_specialize_bytecode(struct bytecode_runtime *bytecode)
 {
 	void *pc, *next_pc, *start_pc;
@@ -426,6 +536,25 @@ int lttng_filter_specialize_bytecode(struct bytecode_runtime *bytecode)
 			break;
 		}
 
+		/* s64 set membership and range tests */
+		case FILTER_OP_IN_SET_S64:
+		{
+			struct set_op *insn = (struct set_op *) pc;
+
+			/* Pop 1, push 1 */
+			vstack_ax(stack)->type = REG_S64;
+			next_pc += sizeof(struct set_op)
+					+ insn->nr_values * sizeof(int64_t);
+			break;
+		}
+		case FILTER_OP_IN_RANGE_S64:
+		{
+			/* Pop 1, push 1 */
+			vstack_ax(stack)->type = REG_S64;
+			next_pc += sizeof(struct range_op);
+			break;
+		}
+
 		/* logical */
 		case FILTER_OP_AND:
 		case FILTER_OP_OR:
@@ -469,6 +598,7 @@ int lttng_filter_specialize_bytecode(struct bytecode_runtime *bytecode)
 			break;
 		}
 		case FILTER_OP_LOAD_FIELD_REF_S64:
+		case FILTER_OP_LOAD_FIELD_REF_INDEX_S64:
 		case FILTER_OP_GET_CONTEXT_REF_S64:
 		{
 			if (vstack_push(stack)) {
@@ -502,6 +632,10 @@ int lttng_filter_specialize_bytecode(struct bytecode_runtime *bytecode)
 			}
 			vstack_ax(stack)->type = REG_STRING;
 			next_pc += sizeof(struct load_op) + strlen(insn->data) + 1;
+			ret = specialize_string_literal(bytecode, insn,
+					ESTACK_STRING_LITERAL_TYPE_PLAIN);
+			if (ret)
+				goto end;
 			break;
 		}
 
@@ -515,6 +649,10 @@ int lttng_filter_specialize_bytecode(struct bytecode_runtime *bytecode)
 			}
 			vstack_ax(stack)->type = REG_STAR_GLOB_STRING;
 			next_pc += sizeof(struct load_op) + strlen(insn->data) + 1;
+			ret = specialize_string_literal(bytecode, insn,
+					ESTACK_STRING_LITERAL_TYPE_STAR_GLOB);
+			if (ret)
+				goto end;
 			break;
 		}
 
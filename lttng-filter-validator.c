@@ -288,6 +288,32 @@ int bytecode_validate_overflow(struct bytecode_runtime *bytecode,
 		break;
 	}
 
+	/* s64 set membership and range tests */
+	case FILTER_OP_IN_SET_S64:
+	{
+		struct set_op *insn = (struct set_op *) pc;
+
+		if (unlikely(pc + sizeof(struct set_op)
+				> start_pc + bytecode->len)) {
+			ret = -ERANGE;
+			break;
+		}
+		if (unlikely(pc + sizeof(struct set_op)
+				+ insn->nr_values * sizeof(int64_t)
+				> start_pc + bytecode->len)) {
+			ret = -ERANGE;
+		}
+		break;
+	}
+	case FILTER_OP_IN_RANGE_S64:
+	{
+		if (unlikely(pc + sizeof(struct range_op)
+				> start_pc + bytecode->len)) {
+			ret = -ERANGE;
+		}
+		break;
+	}
+
 	/* unary */
 	case FILTER_OP_UNARY_PLUS:
 	case FILTER_OP_UNARY_MINUS:
@@ -333,6 +359,7 @@ int bytecode_validate_overflow(struct bytecode_runtime *bytecode,
 	case FILTER_OP_LOAD_FIELD_REF_USER_STRING:
 	case FILTER_OP_LOAD_FIELD_REF_USER_SEQUENCE:
 	case FILTER_OP_LOAD_FIELD_REF_S64:
+	case FILTER_OP_LOAD_FIELD_REF_INDEX_S64:
 	case FILTER_OP_GET_CONTEXT_REF_STRING:
 	case FILTER_OP_GET_CONTEXT_REF_S64:
 	{
@@ -630,6 +657,59 @@ int validate_instruction_context(struct bytecode_runtime *bytecode,
 		break;
 	}
 
+	/* s64 set membership and range tests */
+	case FILTER_OP_IN_SET_S64:
+	{
+		struct set_op *insn = (struct set_op *) pc;
+		unsigned int i;
+
+		if (!vstack_ax(stack)) {
+			printk(KERN_WARNING "Empty stack\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		if (vstack_ax(stack)->type != REG_S64) {
+			printk(KERN_WARNING "Invalid register type\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		if (!insn->nr_values) {
+			printk(KERN_WARNING "Empty set\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		/* Binary search expects sorted values. */
+		for (i = 1; i < insn->nr_values; i++) {
+			if (insn->values[i - 1] >= insn->values[i]) {
+				printk(KERN_WARNING "Set values are not sorted\n");
+				ret = -EINVAL;
+				goto end;
+			}
+		}
+		break;
+	}
+	case FILTER_OP_IN_RANGE_S64:
+	{
+		struct range_op *insn = (struct range_op *) pc;
+
+		if (!vstack_ax(stack)) {
+			printk(KERN_WARNING "Empty stack\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		if (vstack_ax(stack)->type != REG_S64) {
+			printk(KERN_WARNING "Invalid register type\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		if (insn->lo > insn->hi) {
+			printk(KERN_WARNING "Invalid range\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		break;
+	}
+
 	/* logical */
 	case FILTER_OP_AND:
 	case FILTER_OP_OR:
@@ -685,6 +765,21 @@ int validate_instruction_context(struct bytecode_runtime *bytecode,
 			ref->offset);
 		break;
 	}
+	case FILTER_OP_LOAD_FIELD_REF_INDEX_S64:
+	{
+		struct load_op *insn = (struct load_op *) pc;
+		struct field_ref *ref = (struct field_ref *) insn->data;
+
+		if (unlikely(ref->offset >= bytecode->nr_index_refs)) {
+			printk(KERN_WARNING "Invalid field index reference %u\n",
+				ref->offset);
+			ret = -EINVAL;
+			goto end;
+		}
+		dbg_printk("Validate load field ref index %u type s64\n",
+			ref->offset);
+		break;
+	}
 
 	/* load from immediate operand */
 	case FILTER_OP_LOAD_STRING:
@@ -951,6 +1046,35 @@ int exec_insn(struct bytecode_runtime *bytecode,
 		break;
 	}
 
+	/* s64 set membership and range tests */
+	case FILTER_OP_IN_SET_S64:
+	{
+		struct set_op *insn = (struct set_op *) pc;
+
+		/* Pop 1, push 1 */
+		if (!vstack_ax(stack)) {
+			printk(KERN_WARNING "Empty stack\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		vstack_ax(stack)->type = REG_S64;
+		next_pc += sizeof(struct set_op)
+				+ insn->nr_values * sizeof(int64_t);
+		break;
+	}
+	case FILTER_OP_IN_RANGE_S64:
+	{
+		/* Pop 1, push 1 */
+		if (!vstack_ax(stack)) {
+			printk(KERN_WARNING "Empty stack\n");
+			ret = -EINVAL;
+			goto end;
+		}
+		vstack_ax(stack)->type = REG_S64;
+		next_pc += sizeof(struct range_op);
+		break;
+	}
+
 	/* logical */
 	case FILTER_OP_AND:
 	case FILTER_OP_OR:
@@ -1004,6 +1128,7 @@ int exec_insn(struct bytecode_runtime *bytecode,
 		break;
 	}
 	case FILTER_OP_LOAD_FIELD_REF_S64:
+	case FILTER_OP_LOAD_FIELD_REF_INDEX_S64:
 	case FILTER_OP_GET_CONTEXT_REF_S64:
 	{
 		if (vstack_push(stack)) {
@@ -1085,7 +1210,7 @@ int lttng_filter_validate_bytecode(struct bytecode_runtime *bytecode)
 {
 	struct mp_table *mp_table;
 	char *pc, *next_pc, *start_pc;
-	int ret = -EINVAL;
+	int ret = -EINVAL, max_depth = 0;
 	struct vstack stack;
 
 	vstack_init(&stack);
@@ -1120,8 +1245,11 @@ int lttng_filter_validate_bytecode(struct bytecode_runtime *bytecode)
 		ret = exec_insn(bytecode, mp_table, &stack, &next_pc, pc);
 		if (ret <= 0)
 			goto end;
+		max_depth = max(max_depth, stack.top + 1);
 	}
 end:
+	/* Entries needed by the interpreter, including the dummies. */
+	bytecode->stack_len = max_depth + FILTER_STACK_EMPTY + 1;
 	if (delete_all_nodes(mp_table)) {
 		if (!ret) {
 			printk(KERN_WARNING "Unexpected merge points\n");
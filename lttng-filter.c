@@ -26,6 +26,7 @@
 
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
 
 #include <lttng-filter.h>
 
@@ -144,6 +145,16 @@ static const char *opnames[] = {
 	/* globbing pattern binary operator: apply to */
 	[ FILTER_OP_EQ_STAR_GLOB_STRING ] = "EQ_STAR_GLOB_STRING",
 	[ FILTER_OP_NE_STAR_GLOB_STRING ] = "NE_STAR_GLOB_STRING",
+
+	/* load array or sequence element */
+	[ FILTER_OP_LOAD_FIELD_REF_INDEX_S64 ] = "LOAD_FIELD_REF_INDEX_S64",
+
+	/* s64 set membership and range tests */
+	[ FILTER_OP_IN_SET_S64 ] = "IN_SET_S64",
+	[ FILTER_OP_IN_RANGE_S64 ] = "IN_RANGE_S64",
+
+	/* precompiled string literal */
+	[ FILTER_OP_LOAD_STRING_MATCHER ] = "LOAD_STRING_MATCHER",
 };
 
 const char *lttng_filter_print_op(enum filter_op op)
@@ -154,6 +165,89 @@ const char *lttng_filter_print_op(enum filter_op op)
 		return opnames[op];
 }
 
+/*
+ * Split a "field[index]" relocation name into its field name length and
+ * element index. Returns 0 for a plain field name, 1 for an indexed
+ * element, negative error value on malformed name.
+ */
+static
+int parse_field_index(const char *field_name, size_t *name_len,
+		uint64_t *index)
+{
+	const char *open, *close;
+	char buf[21];
+	size_t len;
+
+	open = strchr(field_name, '[');
+	if (!open) {
+		*name_len = strlen(field_name);
+		return 0;
+	}
+	close = strchr(open, ']');
+	if (!close || close[1] != '\0')
+		return -EINVAL;
+	len = close - open - 1;
+	if (!len || len >= sizeof(buf))
+		return -EINVAL;
+	memcpy(buf, open + 1, len);
+	buf[len] = '\0';
+	if (kstrtoull(buf, 10, index))
+		return -EINVAL;
+	*name_len = open - field_name;
+	return 1;
+}
+
+static
+int apply_index_reloc(struct bytecode_runtime *runtime,
+		struct load_op *op,
+		const struct lttng_event_field *field,
+		uint32_t field_offset,
+		uint64_t index)
+{
+	const struct lttng_basic_type *elem_type;
+	struct filter_index_ref *index_ref;
+	struct field_ref *field_ref;
+
+	switch (field->type.atype) {
+	case atype_array:
+		if (index >= field->type.u.array.length)
+			return -EINVAL;
+		elem_type = &field->type.u.array.elem_type;
+		break;
+	case atype_sequence:
+		elem_type = &field->type.u.sequence.elem_type;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (elem_type->atype != atype_integer)
+		return -EINVAL;
+	switch (elem_type->u.basic.integer.size) {
+	case 8:
+	case 16:
+	case 32:
+	case 64:
+		break;
+	default:
+		/* Bitfield arrays are not indexable. */
+		return -EINVAL;
+	}
+
+	index_ref = &runtime->index_refs[runtime->nr_index_refs];
+	index_ref->offset = (uint16_t) field_offset;
+	index_ref->index = index;
+	index_ref->elem_size = elem_type->u.basic.integer.size / CHAR_BIT;
+	index_ref->signedness = elem_type->u.basic.integer.signedness;
+	index_ref->reverse_byte_order =
+		elem_type->u.basic.integer.reverse_byte_order;
+	index_ref->user = field->user;
+
+	op->op = FILTER_OP_LOAD_FIELD_REF_INDEX_S64;
+	field_ref = (struct field_ref *) op->data;
+	field_ref->offset = runtime->nr_index_refs++;
+	return 0;
+}
+
 static
 int apply_field_reloc(struct lttng_event *event,
 		struct bytecode_runtime *runtime,
@@ -167,9 +261,16 @@ int apply_field_reloc(struct lttng_event *event,
 	struct field_ref *field_ref;
 	struct load_op *op;
 	uint32_t field_offset = 0;
+	size_t name_len;
+	uint64_t index;
+	int indexed;
 
 	dbg_printk("Apply field reloc: %u %s\n", reloc_offset, field_name);
 
+	indexed = parse_field_index(field_name, &name_len, &index);
+	if (indexed < 0)
+		return indexed;
+
 	/* Lookup event by name */
 	desc = event->desc;
 	if (!desc)
@@ -179,7 +280,8 @@ int apply_field_reloc(struct lttng_event *event,
 		return -EINVAL;
 	nr_fields = desc->nr_fields;
 	for (i = 0; i < nr_fields; i++) {
-		if (!strcmp(fields[i].name, field_name)) {
+		if (!strncmp(fields[i].name, field_name, name_len)
+				&& fields[i].name[name_len] == '\0') {
 			field = &fields[i];
 			break;
 		}
@@ -197,10 +299,12 @@ int apply_field_reloc(struct lttng_event *event,
 		case atype_string:
 			field_offset += sizeof(void *);
 			break;
-		case atype_struct:		/* Unsupported. */
-		case atype_array_compound:	/* Unsupported. */
-		case atype_sequence_compound:	/* Unsupported. */
-		case atype_variant:		/* Unsupported. */
+		case atype_struct:
+		case atype_array_compound:
+		case atype_sequence_compound:
+		case atype_variant:
+			/* Compound fields have no filter stack slot. */
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -212,8 +316,26 @@ int apply_field_reloc(struct lttng_event *event,
 	if (field_offset > LTTNG_KERNEL_FILTER_BYTECODE_MAX_LEN - 1)
 		return -EINVAL;
 
-	/* set type */
+	/*
+	 * Have the probe prepare this field's filter stack slot. The
+	 * probe may read the event mask before this update while seeing
+	 * the runtime once published: it then skips the runtime, based on
+	 * the runtime mask, rather than read slots it did not fill.
+	 */
+	if (i < LTTNG_EVENT_FIELD_MASK_BITS) {
+		runtime->p.field_mask |= 1ULL << i;
+		WRITE_ONCE(event->filter_field_mask,
+			event->filter_field_mask | (1ULL << i));
+		if (event->filter_locvar_mask & (1ULL << i))
+			WRITE_ONCE(event->filter_after_code_pre, 1);
+	}
+
 	op = (struct load_op *) &runtime->data[reloc_offset];
+	if (indexed)
+		return apply_index_reloc(runtime, op, field, field_offset,
+				index);
+
+	/* set type */
 	field_ref = (struct field_ref *) op->data;
 	switch (field->type.atype) {
 	case atype_integer:
@@ -349,7 +471,7 @@ int _lttng_filter_event_link_bytecode(struct lttng_event *event,
 		struct lttng_filter_bytecode_node *filter_bytecode,
 		struct list_head *insert_loc)
 {
-	int ret, offset, next_offset;
+	int ret, offset, next_offset, nr_relocs;
 	struct bytecode_runtime *runtime = NULL;
 	size_t runtime_alloc_len;
 
@@ -368,6 +490,24 @@ int _lttng_filter_event_link_bytecode(struct lttng_event *event,
 		ret = -ENOMEM;
 		goto alloc_error;
 	}
+	/* At most one index reference per reloc. */
+	for (offset = filter_bytecode->bc.reloc_offset, nr_relocs = 0;
+			offset < filter_bytecode->bc.len;
+			offset = next_offset, nr_relocs++) {
+		const char *name =
+			(const char *) &filter_bytecode->bc.data[offset + sizeof(uint16_t)];
+
+		next_offset = offset + sizeof(uint16_t) + strlen(name) + 1;
+	}
+	if (nr_relocs) {
+		runtime->index_refs = kcalloc(nr_relocs,
+				sizeof(*runtime->index_refs), GFP_KERNEL);
+		if (!runtime->index_refs) {
+			kfree(runtime);
+			ret = -ENOMEM;
+			goto alloc_error;
+		}
+	}
 	runtime->p.bc = filter_bytecode;
 	runtime->len = filter_bytecode->bc.reloc_offset;
 	/* copy original bytecode */
@@ -395,6 +535,14 @@ int _lttng_filter_event_link_bytecode(struct lttng_event *event,
 	if (ret) {
 		goto link_error;
 	}
+	/* Deep expressions do not fit in the interpreter on-stack stack */
+	if (runtime->stack_len > FILTER_STACK_LEN) {
+		runtime->deep_stack = alloc_percpu(struct filter_deep_stack);
+		if (!runtime->deep_stack) {
+			ret = -ENOMEM;
+			goto link_error;
+		}
+	}
 	/* Specialize bytecode */
 	ret = lttng_filter_specialize_bytecode(runtime);
 	if (ret) {
@@ -503,6 +651,9 @@ void lttng_free_event_filter_runtime(struct lttng_event *event)
 
 	list_for_each_entry_safe(runtime, tmp,
 			&event->bytecode_runtime_head, p.node) {
+		lttng_filter_free_string_matchers(runtime);
+		free_percpu(runtime->deep_stack);
+		kfree(runtime->index_refs);
 		kfree(runtime);
 	}
 }
@@ -36,6 +36,15 @@
 #define FILTER_STACK_LEN	10	/* includes 2 dummy */
 #define FILTER_STACK_EMPTY	1
 
+/*
+ * Bytecode needing a deeper execution stack than FILTER_STACK_LEN uses
+ * a per-cpu stack, with one stack per nesting level (thread, softirq,
+ * irq, nmi).
+ */
+#define FILTER_MAX_STACK_DEPTH	32	/* validated expression depth */
+#define FILTER_MAX_STACK_LEN	(FILTER_MAX_STACK_DEPTH + FILTER_STACK_EMPTY + 1)
+#define FILTER_STACK_NESTING	4
+
 #ifdef DEBUG
 #define dbg_printk(fmt, args...)				\
 	printk(KERN_DEBUG "[debug bytecode in %s:%s@%u] " fmt,		\
@@ -50,9 +59,60 @@ do {								\
 } while (0)
 #endif
 
+/*
+ * Integer element of an array or sequence field, resolved at link time
+ * from a "field[index]" relocation.
+ */
+struct filter_index_ref {
+	uint16_t offset;		/* filter stack offset of the field */
+	uint64_t index;			/* element index */
+	unsigned int elem_size;		/* element size, in bytes */
+	unsigned int signedness:1,
+		reverse_byte_order:1,
+		user:1;
+};
+
+/* Execution stack */
+enum estack_string_literal_type {
+	ESTACK_STRING_LITERAL_TYPE_NONE,
+	ESTACK_STRING_LITERAL_TYPE_PLAIN,
+	ESTACK_STRING_LITERAL_TYPE_STAR_GLOB,
+};
+
+/* At most one byte to encode the matcher index in the instruction. */
+#define FILTER_MAX_STRING_MATCHERS	256
+
+enum filter_str_match_type {
+	FILTER_STR_MATCH_GENERIC,	/* use the generic comparator */
+	FILTER_STR_MATCH_LITERAL,	/* candidate equals literal */
+	FILTER_STR_MATCH_PREFIX,	/* literal followed by a star */
+	FILTER_STR_MATCH_SUFFIX,	/* star followed by literal */
+};
+
+/*
+ * String literal operand precompiled by the specializer. The escape
+ * sequences of the literal are resolved once, so the common plain,
+ * prefix and suffix comparisons do not go through parse_char() on
+ * each evaluation.
+ */
+struct filter_str_matcher {
+	enum filter_str_match_type type;
+	enum estack_string_literal_type literal_type;
+	char *pattern;			/* original operand */
+	char *str;			/* escape-resolved literal */
+	size_t len;			/* length of str */
+	uint16_t insn_len;		/* length of the load instruction */
+};
+
 /* Linked bytecode. Child of struct lttng_bytecode_runtime. */
 struct bytecode_runtime {
 	struct lttng_bytecode_runtime p;
+	struct filter_index_ref *index_refs;
+	uint16_t nr_index_refs;
+	struct filter_str_matcher *matchers;
+	uint16_t nr_matchers;
+	uint16_t stack_len;		/* execution stack entries needed */
+	struct filter_deep_stack __percpu *deep_stack;
 	uint16_t len;
 	char data[0];
 };
@@ -72,7 +132,7 @@ struct vstack_entry {
 
 struct vstack {
 	int top;	/* top of stack */
-	struct vstack_entry e[FILTER_STACK_LEN];
+	struct vstack_entry e[FILTER_MAX_STACK_DEPTH];
 };
 
 static inline
@@ -100,7 +160,7 @@ struct vstack_entry *vstack_bx(struct vstack *stack)
 static inline
 int vstack_push(struct vstack *stack)
 {
-	if (stack->top >= FILTER_STACK_LEN - 1) {
+	if (stack->top >= FILTER_MAX_STACK_DEPTH - 1) {
 		printk(KERN_WARNING "Stack full\n");
 		return -EINVAL;
 	}
@@ -119,13 +179,6 @@ int vstack_pop(struct vstack *stack)
 	return 0;
 }
 
-/* Execution stack */
-enum estack_string_literal_type {
-	ESTACK_STRING_LITERAL_TYPE_NONE,
-	ESTACK_STRING_LITERAL_TYPE_PLAIN,
-	ESTACK_STRING_LITERAL_TYPE_STAR_GLOB,
-};
-
 struct estack_entry {
 	union {
 		int64_t v;
@@ -135,14 +188,22 @@ struct estack_entry {
 			const char __user *user_str;
 			size_t seq_len;
 			enum estack_string_literal_type literal_type;
+			/* precompiled literal, or NULL */
+			const struct filter_str_matcher *matcher;
 			int user;		/* is string from userspace ? */
 		} s;
 	} u;
 };
 
 struct estack {
-	int top;	/* top of stack */
-	struct estack_entry e[FILTER_STACK_LEN];
+	int len;	/* number of entries */
+	struct estack_entry *e;
+};
+
+/* Per-cpu execution stacks of bytecode with deep expressions. */
+struct filter_deep_stack {
+	int nesting;
+	struct estack_entry e[FILTER_STACK_NESTING][FILTER_MAX_STACK_LEN];
 };
 
 #define estack_ax_v	ax
@@ -162,7 +223,7 @@ struct estack {
 
 #define estack_push(stack, top, ax, bx)				\
 	do {							\
-		BUG_ON((top) >= FILTER_STACK_LEN - 1);		\
+		BUG_ON((top) >= (stack)->len - 1);		\
 		(stack)->e[(top) - 1].u.v = (bx);		\
 		(bx) = (ax);					\
 		++(top);					\
@@ -180,6 +241,7 @@ const char *lttng_filter_print_op(enum filter_op op);
 
 int lttng_filter_validate_bytecode(struct bytecode_runtime *bytecode);
 int lttng_filter_specialize_bytecode(struct bytecode_runtime *bytecode);
+void lttng_filter_free_string_matchers(struct bytecode_runtime *bytecode);
 
 uint64_t lttng_filter_false(void *filter_data,
 		struct lttng_probe_ctx *lttng_probe_ctx,
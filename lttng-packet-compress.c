@@ -0,0 +1,155 @@
+/*
+ * lttng-packet-compress.c
+ *
+ * LTTng read-side packet compression.
+ *
+ * The packet currently held by the reader (between get_subbuf and
+ * put_subbuf) is compressed straight from a contiguous mapping of the
+ * ring buffer pages, into per-stream scratch memory, and copied to the
+ * consumer-provided buffer. Compression cannot be performed at delivery
+ * (lib_ring_buffer_check_deliver_slow) because it runs in tracing context,
+ * possibly from NMI, and because overwrite-mode writers can reclaim a
+ * delivered sub-buffer at any time. While the reader holds the
+ * sub-buffer, it has exclusive access to it.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; only
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/highmem.h>
+#include <wrapper/lz4.h>
+#include <wrapper/vmalloc.h>
+#include <wrapper/ringbuffer/backend.h>
+#include <wrapper/ringbuffer/frontend.h>
+#include <lttng-packet-compress.h>
+
+#ifdef LTTNG_HAVE_LZ4_COMPRESS
+
+/*
+ * Per-stream compression scratch, allocated on the first compressed read
+ * of the stream and kept until the stream is released, so compressing a
+ * packet does not allocate. Concurrent compressed reads of a stream are
+ * serialized on the scratch mutex.
+ */
+struct lttng_packet_compress_scratch {
+	struct mutex lock;
+	void *dst;			/* Compressed packet */
+	size_t dst_len;			/* Bound for a full sub-buffer */
+	void *wrkmem;			/* LZ4 working memory */
+};
+
+static
+struct lttng_packet_compress_scratch *lttng_packet_compress_get_scratch(
+		struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	struct lttng_packet_compress_scratch *scratch, *old;
+
+	scratch = READ_ONCE(buf->read_priv);
+	if (scratch)
+		return scratch;
+	scratch = kzalloc(sizeof(*scratch), GFP_KERNEL);
+	if (!scratch)
+		return NULL;
+	mutex_init(&scratch->lock);
+	scratch->dst_len = lttng_lz4_compressbound(chan->backend.subbuf_size);
+	scratch->dst = lttng_kvmalloc(scratch->dst_len, GFP_KERNEL);
+	scratch->wrkmem = lttng_kvmalloc(LTTNG_LZ4_MEM_COMPRESS, GFP_KERNEL);
+	if (!scratch->dst || !scratch->wrkmem) {
+		lttng_kvfree(scratch->wrkmem);
+		lttng_kvfree(scratch->dst);
+		kfree(scratch);
+		return NULL;
+	}
+	/* A concurrent first read may have installed its scratch already. */
+	old = cmpxchg(&buf->read_priv, NULL, scratch);
+	if (old) {
+		lttng_kvfree(scratch->wrkmem);
+		lttng_kvfree(scratch->dst);
+		kfree(scratch);
+		return old;
+	}
+	return scratch;
+}
+
+void lttng_packet_compress_release(struct lib_ring_buffer *buf)
+{
+	struct lttng_packet_compress_scratch *scratch = buf->read_priv;
+
+	if (!scratch)
+		return;
+	lttng_kvfree(scratch->wrkmem);
+	lttng_kvfree(scratch->dst);
+	kfree(scratch);
+	buf->read_priv = NULL;
+}
+
+/*
+ * Compress the sub-buffer held by the reader, straight from a contiguous
+ * mapping of its pages. Splice channels are refused: splice moves the
+ * reader sub-buffer pages to the pipe, which the mapping would not follow.
+ */
+int lttng_packet_compress(struct lib_ring_buffer *buf,
+		struct lttng_kernel_compressed_packet *packet)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lttng_packet_compress_scratch *scratch;
+	size_t data_size, out_len;
+	void *src;
+	int ret = 0;
+
+	if (config->output != RING_BUFFER_MMAP)
+		return -EINVAL;
+	if (!buf->get_subbuf)
+		return -EINVAL;
+	if (packet->algorithm != LTTNG_KERNEL_COMPRESSION_LZ4)
+		return -EINVAL;
+	scratch = lttng_packet_compress_get_scratch(buf);
+	if (!scratch)
+		return -ENOMEM;
+	mutex_lock(&scratch->lock);
+	src = lib_ring_buffer_read_vmap(&buf->backend);
+	if (!src) {
+		ret = -ENOMEM;
+		goto end;
+	}
+	data_size = lib_ring_buffer_get_read_data_size(config, buf);
+	/* Writers filled the pages through their linear mapping. */
+	invalidate_kernel_vmap_range(src, data_size);
+	out_len = lttng_lz4_compress(src, data_size, scratch->dst,
+			scratch->dst_len, scratch->wrkmem);
+	if (!out_len) {
+		ret = -EIO;
+		goto end;
+	}
+	packet->content_size = data_size;
+	packet->compressed_size = out_len;
+	if (out_len > packet->len) {
+		/* Let the consumer retry with a large enough buffer. */
+		ret = -ENOSPC;
+		goto end;
+	}
+	if (copy_to_user((void __user *) (unsigned long) packet->addr,
+			scratch->dst, out_len))
+		ret = -EFAULT;
+end:
+	mutex_unlock(&scratch->lock);
+	return ret;
+}
+
+#endif /* #ifdef LTTNG_HAVE_LZ4_COMPRESS */
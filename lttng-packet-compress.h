@@ -0,0 +1,56 @@
+#ifndef _LTTNG_PACKET_COMPRESS_H
+#define _LTTNG_PACKET_COMPRESS_H
+
+/*
+ * lttng-packet-compress.h
+ *
+ * LTTng read-side packet compression.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; only
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <linux/kconfig.h>
+#include <lttng-abi.h>
+
+struct lib_ring_buffer;
+
+/*
+ * Same as IS_REACHABLE(CONFIG_LZ4_COMPRESS), which older kernels lack:
+ * a built-in tracer cannot call into a modular LZ4.
+ */
+#if defined(CONFIG_LZ4_COMPRESS) \
+	|| (defined(CONFIG_LZ4_COMPRESS_MODULE) && defined(MODULE))
+#define LTTNG_HAVE_LZ4_COMPRESS
+#endif
+
+#ifdef LTTNG_HAVE_LZ4_COMPRESS
+int lttng_packet_compress(struct lib_ring_buffer *buf,
+		struct lttng_kernel_compressed_packet *packet);
+void lttng_packet_compress_release(struct lib_ring_buffer *buf);
+#else
+static inline
+int lttng_packet_compress(struct lib_ring_buffer *buf,
+		struct lttng_kernel_compressed_packet *packet)
+{
+	return -ENOSYS;
+}
+
+static inline
+void lttng_packet_compress_release(struct lib_ring_buffer *buf)
+{
+}
+#endif
+
+#endif /* _LTTNG_PACKET_COMPRESS_H */
@@ -22,6 +22,7 @@
 
 #include <linux/module.h>
 #include <linux/types.h>
+#include <linux/log2.h>
 #include <lib/bitfield.h>
 #include <wrapper/vmalloc.h>	/* for wrapper_vmalloc_sync_all() */
 #include <wrapper/trace-clock.h>
@@ -32,6 +33,17 @@
 #define LTTNG_COMPACT_EVENT_BITS	5
 #define LTTNG_COMPACT_TSC_BITS		27
 
+/*
+ * Clients defining RING_BUFFER_RECORD_INDEX_TEMPLATE keep a record offset
+ * index in each packet context, so consumers decoding mmapped packets in
+ * place can seek to a record without walking the packet from its start.
+ */
+#ifdef RING_BUFFER_RECORD_INDEX_TEMPLATE
+#define LTTNG_CLIENT_RECORD_INDEX_LEN	LTTNG_PACKET_RECORD_INDEX_LEN
+#else
+#define LTTNG_CLIENT_RECORD_INDEX_LEN	0
+#endif
+
 static struct lttng_transport lttng_relay_transport;
 
 /*
@@ -72,6 +84,14 @@ struct packet_header {
 						 * (may overflow)
 						 */
 		uint32_t cpu_id;		/* CPU id associated with stream */
+#if LTTNG_CLIENT_RECORD_INDEX_LEN
+		uint32_t record_index[LTTNG_CLIENT_RECORD_INDEX_LEN];
+						/*
+						 * Offset of the first record
+						 * starting in each slice of
+						 * the packet, 0 if none.
+						 */
+#endif
 		uint8_t header_end;		/* End of header */
 	} ctx;
 };
@@ -79,7 +99,11 @@ struct packet_header {
 
 static inline notrace u64 lib_ring_buffer_clock_read(struct channel *chan)
 {
-	return trace_clock_read64();
+	struct lttng_channel *lttng_chan = channel_get_private(chan);
+
+	if (likely(!lttng_chan->clock_read))
+		return trace_clock_read64();
+	return lttng_chan->clock_read();
 }
 
 static inline
@@ -366,6 +390,9 @@ static void client_buffer_begin(struct lib_ring_buffer *buf, u64 tsc,
 				     subbuf_idx;
 	header->ctx.events_discarded = 0;
 	header->ctx.cpu_id = buf->backend.cpu;
+#if LTTNG_CLIENT_RECORD_INDEX_LEN
+	memset(header->ctx.record_index, 0, sizeof(header->ctx.record_index));
+#endif
 }
 
 /*
@@ -501,6 +528,29 @@ int client_instance_id(const struct lib_ring_buffer_config *config,
 	return 0;
 }
 
+/*
+ * Gather the whole index entry from the header of the packet held by the
+ * reader, sparing the consumer one ioctl per field.
+ */
+static
+int client_packet_index(const struct lib_ring_buffer_config *config,
+		struct lib_ring_buffer *buf,
+		struct lttng_kernel_packet_index *index)
+{
+	struct packet_header *header = client_packet_header(config, buf);
+
+	index->timestamp_begin = header->ctx.timestamp_begin;
+	index->timestamp_end = header->ctx.timestamp_end;
+	index->content_size = header->ctx.content_size;
+	index->packet_size = header->ctx.packet_size;
+	index->events_discarded = header->ctx.events_discarded;
+	index->stream_id = header->stream_id;
+	index->seq_num = header->ctx.packet_seq_num;
+	index->stream_instance_id = header->stream_instance_id;
+
+	return 0;
+}
+
 static const struct lib_ring_buffer_config client_config = {
 	.cb.ring_buffer_clock_read = client_ring_buffer_clock_read,
 	.cb.record_header_size = client_record_header_size,
@@ -519,6 +569,7 @@ static const struct lib_ring_buffer_config client_config = {
 	.oops = RING_BUFFER_OOPS_CONSISTENCY,
 	.ipi = RING_BUFFER_IPI_BARRIER,
 	.wakeup = RING_BUFFER_WAKEUP_BY_TIMER,
+	.reserve = RING_BUFFER_RESERVE_CURSOR,
 };
 
 static
@@ -598,6 +649,44 @@ void lttng_buffer_read_close(struct lib_ring_buffer *buf)
 	lib_ring_buffer_release_read(buf);
 }
 
+#if LTTNG_CLIENT_RECORD_INDEX_LEN
+/*
+ * Called with the slot reserved, before the record is committed, so the
+ * index update is ordered before the commit count that delivers the
+ * packet. Only the first record starting within each slice of the packet
+ * is indexed. Per-cpu buffers are only written to by nested contexts of
+ * their own CPU, which always reserve at higher offsets: keeping the
+ * smallest offset is therefore enough to get the first record. A record
+ * reserved from an interrupt nested between a sub-buffer switch and its
+ * buffer_begin callback may be left out of the index, which is only a
+ * hint: a slot holding 0 means the reader has to scan from a previous
+ * slot.
+ */
+static
+void lttng_record_index_update(struct lib_ring_buffer_ctx *ctx)
+{
+	struct channel *chan = ctx->chan;
+	unsigned long offset = ctx->buf_offset;
+	unsigned long rec_offset = subbuf_offset(offset, chan);
+	unsigned int slot;
+	struct packet_header *header;
+
+	header = (struct packet_header *)
+		lib_ring_buffer_offset_address(&ctx->buf->backend,
+			subbuf_index(offset, chan) * chan->backend.subbuf_size);
+	slot = rec_offset >> (chan->backend.subbuf_size_order
+			      - ilog2(LTTNG_CLIENT_RECORD_INDEX_LEN));
+	if (!header->ctx.record_index[slot]
+			|| rec_offset < header->ctx.record_index[slot])
+		header->ctx.record_index[slot] = rec_offset;
+}
+#else
+static inline
+void lttng_record_index_update(struct lib_ring_buffer_ctx *ctx)
+{
+}
+#endif
+
 static
 int lttng_event_reserve(struct lib_ring_buffer_ctx *ctx,
 		      uint32_t event_id)
@@ -626,6 +715,7 @@ int lttng_event_reserve(struct lib_ring_buffer_ctx *ctx,
 	ret = lib_ring_buffer_reserve(&client_config, ctx);
 	if (unlikely(ret))
 		goto put;
+	lttng_record_index_update(ctx);
 	lib_ring_buffer_backend_get_pages(&client_config, ctx,
 			&ctx->backend_pages);
 	lttng_write_event_header(&client_config, ctx, event_id);
@@ -707,6 +797,7 @@ int lttng_is_disabled(struct channel *chan)
 static struct lttng_transport lttng_relay_transport = {
 	.name = "relay-" RING_BUFFER_MODE_TEMPLATE_STRING,
 	.owner = THIS_MODULE,
+	.record_index_len = LTTNG_CLIENT_RECORD_INDEX_LEN,
 	.ops = {
 		.channel_create = _channel_create,
 		.channel_destroy = lttng_channel_destroy,
@@ -735,6 +826,7 @@ static struct lttng_transport lttng_relay_transport = {
 		.current_timestamp = client_current_timestamp,
 		.sequence_number = client_sequence_number,
 		.instance_id = client_instance_id,
+		.packet_index = client_packet_index,
 	},
 };
 
@@ -214,6 +214,14 @@ int client_instance_id(const struct lib_ring_buffer_config *config,
 	return -ENOSYS;
 }
 
+static
+int client_packet_index(const struct lib_ring_buffer_config *config,
+		struct lib_ring_buffer *bufb,
+		struct lttng_kernel_packet_index *index)
+{
+	return -ENOSYS;
+}
+
 static const struct lib_ring_buffer_config client_config = {
 	.cb.ring_buffer_clock_read = client_ring_buffer_clock_read,
 	.cb.record_header_size = client_record_header_size,
@@ -430,6 +438,7 @@ static struct lttng_transport lttng_relay_transport = {
 		.current_timestamp = client_current_timestamp,
 		.sequence_number = client_sequence_number,
 		.instance_id = client_instance_id,
+		.packet_index = client_packet_index,
 	},
 };
 
@@ -45,7 +45,14 @@
 #include <linux/swap.h>
 #include <linux/wait.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <linux/device.h>
+#include <linux/hash.h>
+#include <linux/path.h>
+#include <linux/dcache.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/version.h>
 
 #include <lttng-events.h>
 #include <lttng-tracer.h>
@@ -57,6 +64,9 @@
 #include <wrapper/genhd.h>
 #include <wrapper/file.h>
 #include <wrapper/time.h>
+#include <wrapper/vmalloc.h>
+#include <wrapper/list.h>
+#include <wrapper/compiler.h>
 
 #ifdef CONFIG_LTTNG_HAS_LIST_IRQ
 #include <linux/irq.h>
@@ -73,24 +83,84 @@ DEFINE_TRACE(lttng_statedump_block_device);
 DEFINE_TRACE(lttng_statedump_end);
 DEFINE_TRACE(lttng_statedump_interrupt);
 DEFINE_TRACE(lttng_statedump_file_descriptor);
+DEFINE_TRACE(lttng_statedump_shared_fd_table);
 DEFINE_TRACE(lttng_statedump_start);
 DEFINE_TRACE(lttng_statedump_process_state);
 DEFINE_TRACE(lttng_statedump_network_interface);
 
+#define LTTNG_FD_TABLE_HT_BITS		8
+#define LTTNG_FD_PATH_CACHE_BITS	10
+#define LTTNG_FD_PATH_CACHE_SIZE	(1U << LTTNG_FD_PATH_CACHE_BITS)
+#define LTTNG_FD_PATH_CACHE_PROBE	4
+
+/* File descriptor table already dumped for process @owner. */
+struct lttng_fd_table_entry {
+	struct hlist_node node;
+	struct files_struct *files;
+	struct task_struct *task;	/* Owner process, pinned */
+	pid_t owner;
+};
+
+/* Holds a reference on @path. */
+struct lttng_fd_path_entry {
+	struct path path;
+	char *name;
+};
+
+/*
+ * State of a file descriptor enumeration: shared file descriptor tables
+ * are only dumped once, and the paths of files open in several
+ * processes are only resolved once.
+ */
+struct lttng_fd_dump {
+	char *page;
+	struct hlist_head fd_tables[1U << LTTNG_FD_TABLE_HT_BITS];
+	struct lttng_fd_path_entry path_cache[LTTNG_FD_PATH_CACHE_SIZE];
+};
+
 struct lttng_fd_ctx {
 	char *page;
 	struct lttng_session *session;
 	struct task_struct *p;
 	struct files_struct *files;
+	struct lttng_fd_dump *dump;
+	struct lttng_statedump_throttle *throttle;
 };
 
 /*
- * Protected by the trace lock.
+ * Protected by statedump_mutex, as dumps of different sessions can run
+ * concurrently.
  */
+static DEFINE_MUTEX(statedump_mutex);
 static struct delayed_work cpu_work[NR_CPUS];
 static DECLARE_WAIT_QUEUE_HEAD(statedump_wq);
 static atomic_t kernel_threads_to_run;
 
+/*
+ * The process and file descriptor walks leave their RCU read-side
+ * critical section every LTTNG_STATEDUMP_BATCH_TASKS processes or
+ * LTTNG_STATEDUMP_BATCH_EVENTS events, to reschedule and, when
+ * statedump_max_events_per_sec is set, sleep until the events emitted
+ * so far fit within the rate. A rate-capped dump never runs under the
+ * sessions mutex: it is deferred to the session statedump work.
+ */
+#define LTTNG_STATEDUMP_BATCH_TASKS	64
+#define LTTNG_STATEDUMP_BATCH_EVENTS	1024
+
+static unsigned int statedump_max_events_per_sec;
+module_param(statedump_max_events_per_sec, uint, 0644);
+MODULE_PARM_DESC(statedump_max_events_per_sec,
+	"Maximum rate of process and file descriptor statedump events (0 is unlimited)");
+
+struct lttng_statedump_throttle {
+	struct lttng_session *session;
+	unsigned int rate;		/* Events per second, 0 is unlimited */
+	unsigned long start;		/* jiffies */
+	u64 events;			/* Events emitted since start */
+	u64 batch_events;		/* Value of events at last yield */
+	unsigned int batch_tasks;	/* Tasks walked since last yield */
+};
+
 enum lttng_thread_type {
 	LTTNG_USER_THREAD = 0,
 	LTTNG_KERNEL_THREAD = 1,
@@ -215,11 +285,50 @@ int lttng_enumerate_network_ip_interface(struct lttng_session *session)
 }
 #endif /* CONFIG_INET */
 
+/*
+ * Resolve the path of @file through the path cache. Called with the file
+ * table lock held, so a cache miss inserts the path without sleeping,
+ * and gives up if the probed slots are all taken.
+ */
+static
+const char *lttng_fd_path(struct lttng_fd_dump *dump, struct file *file,
+		char *page)
+{
+	struct lttng_fd_path_entry *free_entry = NULL;
+	unsigned long hash;
+	const char *s;
+	unsigned int i;
+
+	hash = hash_ptr(file->f_path.dentry, LTTNG_FD_PATH_CACHE_BITS);
+	for (i = 0; i < LTTNG_FD_PATH_CACHE_PROBE; i++) {
+		struct lttng_fd_path_entry *entry;
+
+		entry = &dump->path_cache[(hash + i)
+				& (LTTNG_FD_PATH_CACHE_SIZE - 1)];
+		if (!entry->name) {
+			free_entry = entry;
+			break;
+		}
+		if (entry->path.dentry == file->f_path.dentry
+				&& entry->path.mnt == file->f_path.mnt)
+			return entry->name;
+	}
+	s = d_path(&file->f_path, page, PAGE_SIZE);
+	if (IS_ERR(s) || !free_entry)
+		return s;
+	free_entry->name = kstrdup(s, GFP_ATOMIC | __GFP_NOWARN);
+	if (free_entry->name) {
+		free_entry->path = file->f_path;
+		path_get(&free_entry->path);
+	}
+	return s;
+}
+
 static
 int lttng_dump_one_fd(const void *p, struct file *file, unsigned int fd)
 {
 	const struct lttng_fd_ctx *ctx = p;
-	const char *s = d_path(&file->f_path, ctx->page, PAGE_SIZE);
+	const char *s = lttng_fd_path(ctx->dump, file, ctx->page);
 	unsigned int flags = file->f_flags;
 	struct fdtable *fdt;
 
@@ -240,6 +349,7 @@ int lttng_dump_one_fd(const void *p, struct file *file, unsigned int fd)
 	 */
 	if (fd < fdt->max_fds && lttng_close_on_exec(fd, fdt))
 		flags |= O_CLOEXEC;
+	ctx->throttle->events++;
 	if (IS_ERR(s)) {
 		struct dentry *dentry = file->f_path.dentry;
 
@@ -256,17 +366,158 @@ end:
 	return 0;
 }
 
+static
+void lttng_statedump_throttle_init(struct lttng_statedump_throttle *t,
+		struct lttng_session *session, unsigned int rate)
+{
+	memset(t, 0, sizeof(*t));
+	t->session = session;
+	t->rate = rate;
+	t->start = jiffies;
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0))
+static inline
+u64 lttng_task_start_time(struct task_struct *p)
+{
+	return p->start_time;
+}
+#else
+static inline
+u64 lttng_task_start_time(struct task_struct *p)
+{
+	return timespec_to_ns(&p->start_time);
+}
+#endif
+
+/*
+ * Called with the RCU read-side lock held, after dumping process @p.
+ * Returns the process to continue the walk from, which is @p unless
+ * the walk had to leave the RCU read-side critical section and @p
+ * exited in the meantime. The walk then resumes after the last process
+ * created before @p; the process list is kept in creation order.
+ */
+static
+struct task_struct *lttng_statedump_yield(struct lttng_statedump_throttle *t,
+		struct task_struct *p)
+{
+	struct task_struct *prev, *q;
+	u64 start_time;
+
+	if (++t->batch_tasks < LTTNG_STATEDUMP_BATCH_TASKS
+			&& t->events - t->batch_events < LTTNG_STATEDUMP_BATCH_EVENTS)
+		return p;
+	t->batch_tasks = 0;
+	t->batch_events = t->events;
+
+	get_task_struct(p);
+	rcu_read_unlock();
+	if (t->rate) {
+		unsigned long expected;
+
+		/*
+		 * Sleep in short steps, so a session being destroyed does
+		 * not wait for the whole delay: the rest of the dump is
+		 * not recorded anyway once the session is inactive.
+		 */
+		expected = t->start + (unsigned long) div_u64(t->events * HZ, t->rate);
+		while (time_before(jiffies, expected)
+				&& READ_ONCE(t->session->active))
+			schedule_timeout_interruptible(min(expected - jiffies,
+					(unsigned long) HZ / 10 + 1));
+	}
+	cond_resched();
+	rcu_read_lock();
+
+	if (likely(pid_alive(p))) {
+		/* Still on the process list, next_task() is valid. */
+		put_task_struct(p);
+		return p;
+	}
+	start_time = lttng_task_start_time(p);
+	put_task_struct(p);
+	prev = &init_task;
+	for_each_process(q) {
+		if (lttng_task_start_time(q) > start_time)
+			break;
+		prev = q;
+	}
+	return prev;
+}
+
+/*
+ * Returns the process whose file descriptors were already dumped from
+ * @files, or records @p as its owner. Only tables with more than one
+ * user are tracked. As the table is not pinned, it may have been freed
+ * and its address reused since the owner dump: the owner must still
+ * use it for the table to be skipped, otherwise @p takes the entry over.
+ * Called with the task lock of @p held, which keeps @files alive.
+ */
+static
+pid_t lttng_fd_table_owner(struct lttng_fd_dump *dump,
+		struct files_struct *files, struct task_struct *p)
+{
+	struct hlist_head *head;
+	struct lttng_fd_table_entry *entry;
+
+	if (atomic_read(&files->count) <= 1)
+		return p->tgid;
+	head = &dump->fd_tables[hash_ptr(files, LTTNG_FD_TABLE_HT_BITS)];
+	lttng_hlist_for_each_entry(entry, head, node) {
+		int shared;
+
+		if (entry->files != files)
+			continue;
+		if (entry->task == p)
+			return p->tgid;
+		/*
+		 * The owner was walked before @p: task locks are always
+		 * nested in process list order.
+		 */
+		spin_lock_nested(&entry->task->alloc_lock,
+				SINGLE_DEPTH_NESTING);
+		shared = entry->task->files == files;
+		task_unlock(entry->task);
+		if (shared)
+			return entry->owner;
+		put_task_struct(entry->task);
+		get_task_struct(p);
+		entry->task = p;
+		entry->owner = p->tgid;
+		return p->tgid;
+	}
+	/* Called under RCU read-side lock and task lock. */
+	entry = kmalloc(sizeof(*entry), GFP_ATOMIC | __GFP_NOWARN);
+	if (!entry)
+		return p->tgid;
+	get_task_struct(p);
+	entry->files = files;
+	entry->task = p;
+	entry->owner = p->tgid;
+	hlist_add_head(&entry->node, head);
+	return p->tgid;
+}
+
 static
 void lttng_enumerate_task_fd(struct lttng_session *session,
-		struct task_struct *p, char *tmp)
+		struct task_struct *p, struct lttng_fd_dump *dump,
+		struct lttng_statedump_throttle *throttle)
 {
-	struct lttng_fd_ctx ctx = { .page = tmp, .session = session, .p = p };
+	struct lttng_fd_ctx ctx = { .page = dump->page, .session = session,
+		.p = p, .dump = dump, .throttle = throttle };
 	struct files_struct *files;
+	pid_t owner;
 
 	task_lock(p);
 	files = p->files;
 	if (!files)
 		goto end;
+	owner = lttng_fd_table_owner(dump, files, p);
+	if (owner != p->tgid) {
+		trace_lttng_statedump_shared_fd_table(session, p, owner);
+		throttle->events++;
+		goto end;
+	}
 	ctx.files = files;
 	lttng_iterate_fd(files, 0, lttng_dump_one_fd, &ctx);
 end:
@@ -274,21 +525,58 @@ end:
 }
 
 static
-int lttng_enumerate_file_descriptors(struct lttng_session *session)
+void lttng_fd_dump_destroy(struct lttng_fd_dump *dump)
+{
+	struct lttng_fd_table_entry *entry;
+	struct hlist_node *tmp;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(dump->fd_tables); i++) {
+		lttng_hlist_for_each_entry_safe(entry, tmp,
+				&dump->fd_tables[i], node) {
+			put_task_struct(entry->task);
+			kfree(entry);
+		}
+	}
+	for (i = 0; i < LTTNG_FD_PATH_CACHE_SIZE; i++) {
+		struct lttng_fd_path_entry *path_entry = &dump->path_cache[i];
+
+		if (!path_entry->name)
+			continue;
+		path_put(&path_entry->path);
+		kfree(path_entry->name);
+	}
+	free_page((unsigned long) dump->page);
+	lttng_kvfree(dump);
+}
+
+static
+int lttng_enumerate_file_descriptors(struct lttng_session *session,
+		unsigned int rate)
 {
+	struct lttng_statedump_throttle throttle;
+	struct lttng_fd_dump *dump;
 	struct task_struct *p;
-	char *tmp;
 
-	tmp = (char *) __get_free_page(GFP_KERNEL);
-	if (!tmp)
+	dump = lttng_kvzalloc(sizeof(*dump), GFP_KERNEL);
+	if (!dump)
+		return -ENOMEM;
+	dump->page = (char *) __get_free_page(GFP_KERNEL);
+	if (!dump->page) {
+		lttng_kvfree(dump);
 		return -ENOMEM;
+	}
 
 	/* Enumerate active file descriptors */
+	lttng_statedump_throttle_init(&throttle, session, rate);
 	rcu_read_lock();
-	for_each_process(p)
-		lttng_enumerate_task_fd(session, p, tmp);
+	for_each_process(p) {
+		lttng_enumerate_task_fd(session, p, dump, &throttle);
+		p = lttng_statedump_yield(&throttle, p);
+	}
 	rcu_read_unlock();
-	free_page((unsigned long) tmp);
+	/* Drops the path references, may sleep. */
+	lttng_fd_dump_destroy(dump);
 	return 0;
 }
 
@@ -402,10 +690,13 @@ void lttng_statedump_process_ns(struct lttng_session *session,
 }
 
 static
-int lttng_enumerate_process_states(struct lttng_session *session)
+int lttng_enumerate_process_states(struct lttng_session *session,
+		unsigned int rate)
 {
+	struct lttng_statedump_throttle throttle;
 	struct task_struct *g, *p;
 
+	lttng_statedump_throttle_init(&throttle, session, rate);
 	rcu_read_lock();
 	for_each_process(g) {
 		p = g;
@@ -453,7 +744,9 @@ int lttng_enumerate_process_states(struct lttng_session *session)
 			lttng_statedump_process_ns(session,
 				p, type, mode, submode, status);
 			task_unlock(p);
+			throttle.events++;
 		} while_each_thread(g, p);
+		g = lttng_statedump_yield(&throttle, g);
 	}
 	rcu_read_unlock();
 
@@ -469,15 +762,15 @@ void lttng_statedump_work_func(struct work_struct *work)
 }
 
 static
-int do_lttng_statedump(struct lttng_session *session)
+int do_lttng_statedump(struct lttng_session *session, unsigned int rate)
 {
 	int cpu, ret;
 
 	trace_lttng_statedump_start(session);
-	ret = lttng_enumerate_process_states(session);
+	ret = lttng_enumerate_process_states(session, rate);
 	if (ret)
 		return ret;
-	ret = lttng_enumerate_file_descriptors(session);
+	ret = lttng_enumerate_file_descriptors(session, rate);
 	if (ret)
 		return ret;
 	/*
@@ -513,6 +806,7 @@ int do_lttng_statedump(struct lttng_session *session)
 	 * is to guarantee that each CPU has been in a state where is was in
 	 * syscall mode (i.e. not in a trap, an IRQ or a soft IRQ).
 	 */
+	mutex_lock(&statedump_mutex);
 	get_online_cpus();
 	atomic_set(&kernel_threads_to_run, num_online_cpus());
 	for_each_online_cpu(cpu) {
@@ -522,20 +816,47 @@ int do_lttng_statedump(struct lttng_session *session)
 	/* Wait for all threads to run */
 	__wait_event(statedump_wq, (atomic_read(&kernel_threads_to_run) == 0));
 	put_online_cpus();
+	mutex_unlock(&statedump_mutex);
 	/* Our work is done */
 	trace_lttng_statedump_end(session);
 	return 0;
 }
 
 /*
- * Called with session mutex held.
+ * Called with session mutex held. When the event rate is capped, the
+ * dump sleeps between batches: it is deferred to the session statedump
+ * work rather than hold the sessions mutex while sleeping. Requests made
+ * while a dump is pending are merged with it.
  */
 int lttng_statedump_start(struct lttng_session *session)
 {
-	return do_lttng_statedump(session);
+	if (READ_ONCE(statedump_max_events_per_sec)) {
+		queue_work(system_long_wq, &session->statedump_work);
+		return 0;
+	}
+	return do_lttng_statedump(session, 0);
 }
 EXPORT_SYMBOL_GPL(lttng_statedump_start);
 
+/*
+ * Session statedump work, cancelled by lttng_session_destroy() before
+ * the session is freed. The work is not reentrant, which serializes the
+ * deferred dumps of a session.
+ */
+void lttng_statedump_session_work(struct work_struct *work)
+{
+	struct lttng_session *session =
+		container_of(work, struct lttng_session, statedump_work);
+	int ret;
+
+	ret = do_lttng_statedump(session,
+			READ_ONCE(statedump_max_events_per_sec));
+	if (ret)
+		printk(KERN_WARNING "LTTng: deferred statedump failed (%d)\n",
+			ret);
+}
+EXPORT_SYMBOL_GPL(lttng_statedump_session_work);
+
 static
 int __init lttng_statedump_init(void)
 {
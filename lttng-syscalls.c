@@ -31,6 +31,9 @@
 #include <linux/stringify.h>
 #include <linux/file.h>
 #include <linux/anon_inodes.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include <linux/hash.h>
 #include <asm/ptrace.h>
 #include <asm/syscall.h>
 
@@ -38,6 +41,8 @@
 #include <wrapper/tracepoint.h>
 #include <wrapper/file.h>
 #include <wrapper/rcu.h>
+#include <wrapper/vmalloc.h>
+#include <wrapper/compiler.h>
 #include <lttng-events.h>
 
 #ifndef CONFIG_COMPAT
@@ -91,6 +96,62 @@ struct user_msghdr;
 #define NR_compat_syscalls NR_syscalls
 #endif
 
+/*
+ * Optional capture of the read(2)/write(2) data buffers. The snap
+ * lengths cap the number of bytes copied from user space per event, 0
+ * (the default) disabling the capture altogether. The rate limits the
+ * number of captures per cpu per second, 0 meaning unlimited. Events
+ * beyond the limit are still recorded, with an empty payload.
+ */
+static unsigned int syscall_read_snaplen;
+module_param(syscall_read_snaplen, uint, 0644);
+MODULE_PARM_DESC(syscall_read_snaplen,
+	"Number of bytes of read(2) data to record (0 disables capture)");
+
+static unsigned int syscall_write_snaplen;
+module_param(syscall_write_snaplen, uint, 0644);
+MODULE_PARM_DESC(syscall_write_snaplen,
+	"Number of bytes of write(2) data to record (0 disables capture)");
+
+static unsigned int syscall_payload_rate;
+module_param(syscall_payload_rate, uint, 0644);
+MODULE_PARM_DESC(syscall_payload_rate,
+	"Maximum number of payload captures per cpu per second (0 is unlimited)");
+
+struct lttng_syscall_payload_ratelimit {
+	unsigned long begin;	/* jiffies */
+	unsigned int count;
+};
+
+static DEFINE_PER_CPU(struct lttng_syscall_payload_ratelimit,
+		lttng_syscall_payload_ratelimit);
+
+/*
+ * Called from the probes, with preemption disabled. Returns the number
+ * of payload bytes to record for a buffer of @len bytes.
+ */
+static
+unsigned int lttng_syscall_payload_snaplen(unsigned int snaplen, long len)
+{
+	struct lttng_syscall_payload_ratelimit *rl;
+	unsigned int rate;
+
+	if (!snaplen || len <= 0)
+		return 0;
+	rate = READ_ONCE(syscall_payload_rate);
+	if (rate) {
+		rl = this_cpu_ptr(&lttng_syscall_payload_ratelimit);
+		if (time_after(jiffies, rl->begin + HZ)) {
+			rl->begin = jiffies;
+			rl->count = 0;
+		}
+		if (rl->count >= rate)
+			return 0;
+		rl->count++;
+	}
+	return min_t(unsigned long, len, snaplen);
+}
+
 /*
  * Create LTTng tracepoint probes.
  */
@@ -366,11 +427,202 @@ const struct trace_syscall_entry compat_sc_exit_table[] = {
 
 #undef CREATE_SYSCALL_TABLE
 
+/*
+ * Per-channel syscall dispatch array. The native entry, native exit,
+ * compat entry and compat exit tables are laid out back to back in a
+ * single allocation, each followed by one slot holding the event used
+ * for unknown system calls. The probes only touch the slot of the
+ * system call being traced.
+ */
+struct lttng_syscall_dispatch {
+	struct lttng_event *event;
+	void *func;
+	unsigned int nrargs;
+};
+
+#define SC_DISPATCH_ENTRY_OFFSET	0
+#define SC_DISPATCH_EXIT_OFFSET		\
+	(SC_DISPATCH_ENTRY_OFFSET + ARRAY_SIZE(sc_table) + 1)
+#define SC_DISPATCH_COMPAT_ENTRY_OFFSET	\
+	(SC_DISPATCH_EXIT_OFFSET + ARRAY_SIZE(sc_exit_table) + 1)
+#define SC_DISPATCH_COMPAT_EXIT_OFFSET	\
+	(SC_DISPATCH_COMPAT_ENTRY_OFFSET + ARRAY_SIZE(compat_sc_table) + 1)
+#define SC_DISPATCH_LEN			\
+	(SC_DISPATCH_COMPAT_EXIT_OFFSET + ARRAY_SIZE(compat_sc_exit_table) + 1)
+
+struct sc_dispatch_layout {
+	const struct trace_syscall_entry *table;
+	size_t len;
+	size_t offset;
+	const struct lttng_event_desc *unknown_desc;
+	const char *prefix;
+	int compat;
+};
+
+static const struct sc_dispatch_layout sc_dispatch_layout[] = {
+	[SC_TYPE_ENTRY] = {
+		.table = sc_table,
+		.len = ARRAY_SIZE(sc_table),
+		.offset = SC_DISPATCH_ENTRY_OFFSET,
+		.unknown_desc = &__event_desc___syscall_entry_unknown,
+		.prefix = SYSCALL_ENTRY_STR,
+	},
+	[SC_TYPE_EXIT] = {
+		.table = sc_exit_table,
+		.len = ARRAY_SIZE(sc_exit_table),
+		.offset = SC_DISPATCH_EXIT_OFFSET,
+		.unknown_desc = &__event_desc___syscall_exit_unknown,
+		.prefix = SYSCALL_EXIT_STR,
+	},
+	[SC_TYPE_COMPAT_ENTRY] = {
+		.table = compat_sc_table,
+		.len = ARRAY_SIZE(compat_sc_table),
+		.offset = SC_DISPATCH_COMPAT_ENTRY_OFFSET,
+		.unknown_desc = &__event_desc___compat_syscall_entry_unknown,
+		.prefix = COMPAT_SYSCALL_ENTRY_STR,
+		.compat = 1,
+	},
+	[SC_TYPE_COMPAT_EXIT] = {
+		.table = compat_sc_exit_table,
+		.len = ARRAY_SIZE(compat_sc_exit_table),
+		.offset = SC_DISPATCH_COMPAT_EXIT_OFFSET,
+		.unknown_desc = &__event_desc___compat_syscall_exit_unknown,
+		.prefix = COMPAT_SYSCALL_EXIT_STR,
+		.compat = 1,
+	},
+};
+
+/*
+ * Each system call event, entry or exit, native or compat, owns one
+ * bit, set while the event is registered. Enablers match the entry and
+ * exit events of a system call alike, the channel system call mask
+ * (LTTNG_KERNEL_SYSCALL_MASK_UPDATE) controls them separately.
+ */
 struct lttng_syscall_filter {
 	DECLARE_BITMAP(sc, NR_syscalls);
 	DECLARE_BITMAP(sc_compat, NR_compat_syscalls);
+	DECLARE_BITMAP(sc_exit, NR_syscalls);
+	DECLARE_BITMAP(sc_compat_exit, NR_compat_syscalls);
+};
+
+/*
+ * Per-channel stash of system call arguments. The entry probe saves the
+ * arguments when the matching exit event is enabled, and the exit probe
+ * uses them rather than re-reading registers the system call may have
+ * clobbered. Slots are indexed by task; a slot is claimed with a
+ * cmpxchg on its owner and stays valid until another task hashing to
+ * the same slot claims it. On contention, the exit probe falls back on
+ * the registers.
+ */
+#define SC_STASH_BITS		10
+#define SC_STASH_SLOTS		(1U << SC_STASH_BITS)
+#define SC_STASH_BUSY		((struct task_struct *) 1UL)
+#define SC_STASH_COMPAT		(1U << 31)
+
+struct lttng_syscall_stash {
+	struct task_struct *owner;
+	pid_t pid;
+	unsigned int nr;	/* syscall id, ORed with SC_STASH_COMPAT */
+	unsigned long args[UNKNOWN_SYSCALL_NRARGS];
 };
 
+static
+struct lttng_syscall_stash *syscall_stash_slot(struct lttng_channel *chan)
+{
+	return &chan->sc_stash[hash_ptr(current, SC_STASH_BITS)];
+}
+
+static
+void syscall_stash_drop(struct lttng_channel *chan)
+{
+	struct lttng_syscall_stash *slot = syscall_stash_slot(chan);
+
+	if (READ_ONCE(slot->owner) == current)
+		(void) cmpxchg(&slot->owner, current, NULL);
+}
+
+/*
+ * Called from the entry probe, before the entry filter is applied:
+ * the exit event can be enabled independently of the entry event.
+ */
+static
+void syscall_stash_save(struct lttng_channel *chan, struct pt_regs *regs,
+		long id)
+{
+	struct lttng_syscall_filter *filter;
+	struct lttng_syscall_stash *slot;
+	struct lttng_event *exit_event;
+	struct task_struct *owner;
+	unsigned int nr;
+
+	if (unlikely(id < 0))
+		return;
+	filter = lttng_rcu_dereference(chan->sc_filter);
+	if (unlikely(in_compat_syscall())) {
+		if (id >= ARRAY_SIZE(compat_sc_exit_table))
+			return;
+		if (filter && (id >= NR_compat_syscalls
+				|| !test_bit(id, filter->sc_compat_exit)))
+			goto drop;
+		exit_event = chan->sc_dispatch[SC_DISPATCH_COMPAT_EXIT_OFFSET + id].event;
+		nr = id | SC_STASH_COMPAT;
+	} else {
+		if (id >= ARRAY_SIZE(sc_exit_table))
+			return;
+		if (filter && (id >= NR_syscalls
+				|| !test_bit(id, filter->sc_exit)))
+			goto drop;
+		exit_event = chan->sc_dispatch[SC_DISPATCH_EXIT_OFFSET + id].event;
+		nr = id;
+	}
+	if (!exit_event || !READ_ONCE(exit_event->enabled))
+		goto drop;
+
+	slot = syscall_stash_slot(chan);
+	owner = READ_ONCE(slot->owner);
+	if (owner == SC_STASH_BUSY
+			|| cmpxchg(&slot->owner, owner, SC_STASH_BUSY) != owner)
+		return;
+	slot->pid = current->pid;
+	slot->nr = nr;
+	syscall_get_arguments(current, regs, 0, UNKNOWN_SYSCALL_NRARGS,
+		slot->args);
+	smp_wmb();	/* Publish arguments before owner. */
+	WRITE_ONCE(slot->owner, current);
+	return;
+
+drop:
+	/* Do not let a stale stash be used by this syscall exit. */
+	syscall_stash_drop(chan);
+}
+
+/*
+ * Fetch the arguments of the system call being exited, from the stash
+ * if the entry probe saved them, else from the registers.
+ */
+static
+void syscall_exit_get_arguments(struct lttng_channel *chan,
+		struct pt_regs *regs, long id, unsigned int nrargs,
+		unsigned long *args)
+{
+	struct lttng_syscall_stash *slot = syscall_stash_slot(chan);
+	unsigned int nr = id;
+
+	if (unlikely(in_compat_syscall()))
+		nr |= SC_STASH_COMPAT;
+	if (READ_ONCE(slot->owner) != current)
+		goto regs;
+	smp_rmb();	/* Read owner before arguments. */
+	if (slot->pid != current->pid || slot->nr != nr)
+		goto regs;
+	memcpy(args, slot->args, nrargs * sizeof(unsigned long));
+	smp_rmb();	/* Read arguments before validating owner. */
+	if (READ_ONCE(slot->owner) == current)
+		return;
+regs:
+	syscall_get_arguments(current, regs, 0, nrargs, args);
+}
+
 static void syscall_entry_unknown(struct lttng_event *event,
 	struct pt_regs *regs, unsigned int id)
 {
@@ -386,10 +638,11 @@ static void syscall_entry_unknown(struct lttng_event *event,
 void syscall_entry_probe(void *__data, struct pt_regs *regs, long id)
 {
 	struct lttng_channel *chan = __data;
-	struct lttng_event *event, *unknown_event;
-	const struct trace_syscall_entry *table, *entry;
+	const struct lttng_syscall_dispatch *dispatch, *entry;
+	struct lttng_event *event;
 	size_t table_len;
 
+	syscall_stash_save(chan, regs, id);
 	if (unlikely(in_compat_syscall())) {
 		struct lttng_syscall_filter *filter;
 
@@ -401,9 +654,8 @@ void syscall_entry_probe(void *__data, struct pt_regs *regs, long id)
 				return;
 			}
 		}
-		table = compat_sc_table;
+		dispatch = chan->sc_dispatch + SC_DISPATCH_COMPAT_ENTRY_OFFSET;
 		table_len = ARRAY_SIZE(compat_sc_table);
-		unknown_event = chan->sc_compat_unknown;
 	} else {
 		struct lttng_syscall_filter *filter;
 
@@ -415,24 +667,15 @@ void syscall_entry_probe(void *__data, struct pt_regs *regs, long id)
 				return;
 			}
 		}
-		table = sc_table;
+		dispatch = chan->sc_dispatch + SC_DISPATCH_ENTRY_OFFSET;
 		table_len = ARRAY_SIZE(sc_table);
-		unknown_event = chan->sc_unknown;
 	}
-	if (unlikely(id < 0 || id >= table_len)) {
-		syscall_entry_unknown(unknown_event, regs, id);
-		return;
-	}
-	if (unlikely(in_compat_syscall()))
-		event = chan->compat_sc_table[id];
-	else
-		event = chan->sc_table[id];
-	if (unlikely(!event)) {
-		syscall_entry_unknown(unknown_event, regs, id);
-		return;
-	}
-	entry = &table[id];
-	WARN_ON_ONCE(!entry);
+	if (unlikely(id < 0 || id >= table_len))
+		goto unknown;
+	entry = &dispatch[id];
+	event = entry->event;
+	if (unlikely(!event))
+		goto unknown;
 
 	switch (entry->nrargs) {
 	case 0:
@@ -520,6 +763,11 @@ void syscall_entry_probe(void *__data, struct pt_regs *regs, long id)
 	default:
 		break;
 	}
+	return;
+
+unknown:
+	/* The unknown system call slot follows the table. */
+	syscall_entry_unknown(dispatch[table_len].event, regs, id);
 }
 
 static void syscall_exit_unknown(struct lttng_event *event,
@@ -538,8 +786,8 @@ static void syscall_exit_unknown(struct lttng_event *event,
 void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 {
 	struct lttng_channel *chan = __data;
-	struct lttng_event *event, *unknown_event;
-	const struct trace_syscall_entry *table, *entry;
+	const struct lttng_syscall_dispatch *dispatch, *entry;
+	struct lttng_event *event;
 	size_t table_len;
 	long id;
 
@@ -550,43 +798,33 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 		filter = lttng_rcu_dereference(chan->sc_filter);
 		if (filter) {
 			if (id < 0 || id >= NR_compat_syscalls
-				|| !test_bit(id, filter->sc_compat)) {
+				|| !test_bit(id, filter->sc_compat_exit)) {
 				/* System call filtered out. */
 				return;
 			}
 		}
-		table = compat_sc_exit_table;
+		dispatch = chan->sc_dispatch + SC_DISPATCH_COMPAT_EXIT_OFFSET;
 		table_len = ARRAY_SIZE(compat_sc_exit_table);
-		unknown_event = chan->compat_sc_exit_unknown;
 	} else {
 		struct lttng_syscall_filter *filter;
 
 		filter = lttng_rcu_dereference(chan->sc_filter);
 		if (filter) {
 			if (id < 0 || id >= NR_syscalls
-				|| !test_bit(id, filter->sc)) {
+				|| !test_bit(id, filter->sc_exit)) {
 				/* System call filtered out. */
 				return;
 			}
 		}
-		table = sc_exit_table;
+		dispatch = chan->sc_dispatch + SC_DISPATCH_EXIT_OFFSET;
 		table_len = ARRAY_SIZE(sc_exit_table);
-		unknown_event = chan->sc_exit_unknown;
-	}
-	if (unlikely(id < 0 || id >= table_len)) {
-		syscall_exit_unknown(unknown_event, regs, id, ret);
-		return;
-	}
-	if (unlikely(in_compat_syscall()))
-		event = chan->compat_sc_exit_table[id];
-	else
-		event = chan->sc_exit_table[id];
-	if (unlikely(!event)) {
-		syscall_exit_unknown(unknown_event, regs, id, ret);
-		return;
 	}
-	entry = &table[id];
-	WARN_ON_ONCE(!entry);
+	if (unlikely(id < 0 || id >= table_len))
+		goto unknown;
+	entry = &dispatch[id];
+	event = entry->event;
+	if (unlikely(!event))
+		goto unknown;
 
 	switch (entry->nrargs) {
 	case 0:
@@ -603,7 +841,7 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 			unsigned long arg0) = entry->func;
 		unsigned long args[1];
 
-		syscall_get_arguments(current, regs, 0, entry->nrargs, args);
+		syscall_exit_get_arguments(chan, regs, id, entry->nrargs, args);
 		fptr(event, ret, args[0]);
 		break;
 	}
@@ -615,7 +853,7 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 			unsigned long arg1) = entry->func;
 		unsigned long args[2];
 
-		syscall_get_arguments(current, regs, 0, entry->nrargs, args);
+		syscall_exit_get_arguments(chan, regs, id, entry->nrargs, args);
 		fptr(event, ret, args[0], args[1]);
 		break;
 	}
@@ -628,7 +866,7 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 			unsigned long arg2) = entry->func;
 		unsigned long args[3];
 
-		syscall_get_arguments(current, regs, 0, entry->nrargs, args);
+		syscall_exit_get_arguments(chan, regs, id, entry->nrargs, args);
 		fptr(event, ret, args[0], args[1], args[2]);
 		break;
 	}
@@ -642,7 +880,7 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 			unsigned long arg3) = entry->func;
 		unsigned long args[4];
 
-		syscall_get_arguments(current, regs, 0, entry->nrargs, args);
+		syscall_exit_get_arguments(chan, regs, id, entry->nrargs, args);
 		fptr(event, ret, args[0], args[1], args[2], args[3]);
 		break;
 	}
@@ -657,7 +895,7 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 			unsigned long arg4) = entry->func;
 		unsigned long args[5];
 
-		syscall_get_arguments(current, regs, 0, entry->nrargs, args);
+		syscall_exit_get_arguments(chan, regs, id, entry->nrargs, args);
 		fptr(event, ret, args[0], args[1], args[2], args[3], args[4]);
 		break;
 	}
@@ -673,7 +911,7 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 			unsigned long arg5) = entry->func;
 		unsigned long args[6];
 
-		syscall_get_arguments(current, regs, 0, entry->nrargs, args);
+		syscall_exit_get_arguments(chan, regs, id, entry->nrargs, args);
 		fptr(event, ret, args[0], args[1], args[2],
 			args[3], args[4], args[5]);
 		break;
@@ -681,6 +919,40 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
 	default:
 		break;
 	}
+	return;
+
+unknown:
+	/* The unknown system call slot follows the table. */
+	syscall_exit_unknown(dispatch[table_len].event, regs, id, ret);
+}
+
+/*
+ * Should be called with sessions lock held.
+ */
+static
+int fill_unknown(struct lttng_channel *chan, void *filter, enum sc_type type)
+{
+	const struct sc_dispatch_layout *layout = &sc_dispatch_layout[type];
+	struct lttng_syscall_dispatch *slot =
+		&chan->sc_dispatch[layout->offset + layout->len];
+	const struct lttng_event_desc *desc = layout->unknown_desc;
+	struct lttng_kernel_event ev;
+	struct lttng_event *event;
+
+	if (slot->event)
+		return 0;
+	memset(&ev, 0, sizeof(ev));
+	strncpy(ev.name, desc->name, LTTNG_KERNEL_SYM_NAME_LEN);
+	ev.name[LTTNG_KERNEL_SYM_NAME_LEN - 1] = '\0';
+	ev.instrumentation = LTTNG_KERNEL_SYSCALL;
+	event = _lttng_event_create(chan, &ev, filter, desc,
+			ev.instrumentation);
+	WARN_ON_ONCE(!event);
+	if (IS_ERR(event))
+		return PTR_ERR(event);
+	event->u.syscall.index = layout->offset + layout->len;
+	slot->event = event;
+	return 0;
 }
 
 /*
@@ -688,18 +960,21 @@ void syscall_exit_probe(void *__data, struct pt_regs *regs, long ret)
  * Should be called with sessions lock held.
  */
 static
-int fill_table(const struct trace_syscall_entry *table, size_t table_len,
-	struct lttng_event **chan_table, struct lttng_channel *chan,
-	void *filter, enum sc_type type)
+int fill_table(struct lttng_channel *chan, void *filter, enum sc_type type)
 {
+	const struct sc_dispatch_layout *layout = &sc_dispatch_layout[type];
+	struct lttng_syscall_dispatch *dispatch =
+		&chan->sc_dispatch[layout->offset];
 	const struct lttng_event_desc *desc;
 	unsigned int i;
 
 	/* Allocate events for each syscall, insert into table */
-	for (i = 0; i < table_len; i++) {
+	for (i = 0; i < layout->len; i++) {
+		const struct trace_syscall_entry *entry = &layout->table[i];
 		struct lttng_kernel_event ev;
-		desc = table[i].desc;
+		struct lttng_event *event;
 
+		desc = entry->desc;
 		if (!desc) {
 			/* Unknown syscall */
 			continue;
@@ -708,46 +983,30 @@ int fill_table(const struct trace_syscall_entry *table, size_t table_len,
 		 * Skip those already populated by previous failed
 		 * register for this channel.
 		 */
-		if (chan_table[i])
+		if (dispatch[i].event)
 			continue;
 		memset(&ev, 0, sizeof(ev));
-		switch (type) {
-		case SC_TYPE_ENTRY:
-			strncpy(ev.name, SYSCALL_ENTRY_STR,
-				LTTNG_KERNEL_SYM_NAME_LEN);
-			break;
-		case SC_TYPE_EXIT:
-			strncpy(ev.name, SYSCALL_EXIT_STR,
-				LTTNG_KERNEL_SYM_NAME_LEN);
-			break;
-		case SC_TYPE_COMPAT_ENTRY:
-			strncpy(ev.name, COMPAT_SYSCALL_ENTRY_STR,
-				LTTNG_KERNEL_SYM_NAME_LEN);
-			break;
-		case SC_TYPE_COMPAT_EXIT:
-			strncpy(ev.name, COMPAT_SYSCALL_EXIT_STR,
-				LTTNG_KERNEL_SYM_NAME_LEN);
-			break;
-		default:
-			BUG_ON(1);
-			break;
-		}
+		strncpy(ev.name, layout->prefix, LTTNG_KERNEL_SYM_NAME_LEN);
 		strncat(ev.name, desc->name,
 			LTTNG_KERNEL_SYM_NAME_LEN - strlen(ev.name) - 1);
 		ev.name[LTTNG_KERNEL_SYM_NAME_LEN - 1] = '\0';
 		ev.instrumentation = LTTNG_KERNEL_SYSCALL;
-		chan_table[i] = _lttng_event_create(chan, &ev, filter,
+		event = _lttng_event_create(chan, &ev, filter,
 						desc, ev.instrumentation);
-		WARN_ON_ONCE(!chan_table[i]);
-		if (IS_ERR(chan_table[i])) {
+		WARN_ON_ONCE(!event);
+		if (IS_ERR(event)) {
 			/*
 			 * If something goes wrong in event registration
 			 * after the first one, we have no choice but to
 			 * leave the previous events in there, until
 			 * deleted by session teardown.
 			 */
-			return PTR_ERR(chan_table[i]);
+			return PTR_ERR(event);
 		}
+		event->u.syscall.index = layout->offset + i;
+		dispatch[i].func = entry->func;
+		dispatch[i].nrargs = entry->nrargs;
+		dispatch[i].event = event;
 	}
 	return 0;
 }
@@ -757,132 +1016,42 @@ int fill_table(const struct trace_syscall_entry *table, size_t table_len,
  */
 int lttng_syscalls_register(struct lttng_channel *chan, void *filter)
 {
-	struct lttng_kernel_event ev;
-	int ret;
+	enum sc_type type;
+	int ret = 0;
 
-	wrapper_vmalloc_sync_all();
-
-	if (!chan->sc_table) {
-		/* create syscall table mapping syscall to events */
-		chan->sc_table = kzalloc(sizeof(struct lttng_event *)
-					* ARRAY_SIZE(sc_table), GFP_KERNEL);
-		if (!chan->sc_table)
-			return -ENOMEM;
-	}
-	if (!chan->sc_exit_table) {
-		/* create syscall table mapping syscall to events */
-		chan->sc_exit_table = kzalloc(sizeof(struct lttng_event *)
-					* ARRAY_SIZE(sc_exit_table), GFP_KERNEL);
-		if (!chan->sc_exit_table)
+	if (!chan->sc_stash) {
+		chan->sc_stash = lttng_kvzalloc(SC_STASH_SLOTS
+				* sizeof(struct lttng_syscall_stash),
+				GFP_KERNEL);
+		if (!chan->sc_stash)
 			return -ENOMEM;
 	}
 
+	wrapper_vmalloc_sync_all();
 
-#ifdef CONFIG_COMPAT
-	if (!chan->compat_sc_table) {
-		/* create syscall table mapping compat syscall to events */
-		chan->compat_sc_table = kzalloc(sizeof(struct lttng_event *)
-					* ARRAY_SIZE(compat_sc_table), GFP_KERNEL);
-		if (!chan->compat_sc_table)
+	if (!chan->sc_dispatch) {
+		/* create dispatch array mapping syscalls to events */
+		chan->sc_dispatch = kcalloc(SC_DISPATCH_LEN,
+				sizeof(struct lttng_syscall_dispatch),
+				GFP_KERNEL);
+		if (!chan->sc_dispatch)
 			return -ENOMEM;
 	}
 
-	if (!chan->compat_sc_exit_table) {
-		/* create syscall table mapping compat syscall to events */
-		chan->compat_sc_exit_table = kzalloc(sizeof(struct lttng_event *)
-					* ARRAY_SIZE(compat_sc_exit_table), GFP_KERNEL);
-		if (!chan->compat_sc_exit_table)
-			return -ENOMEM;
+	for (type = 0; type < ARRAY_SIZE(sc_dispatch_layout); type++) {
+		ret = fill_unknown(chan, filter, type);
+		if (ret)
+			return ret;
 	}
+	for (type = 0; type < ARRAY_SIZE(sc_dispatch_layout); type++) {
+#ifndef CONFIG_COMPAT
+		if (sc_dispatch_layout[type].compat)
+			continue;
 #endif
-	if (!chan->sc_unknown) {
-		const struct lttng_event_desc *desc =
-			&__event_desc___syscall_entry_unknown;
-
-		memset(&ev, 0, sizeof(ev));
-		strncpy(ev.name, desc->name, LTTNG_KERNEL_SYM_NAME_LEN);
-		ev.name[LTTNG_KERNEL_SYM_NAME_LEN - 1] = '\0';
-		ev.instrumentation = LTTNG_KERNEL_SYSCALL;
-		chan->sc_unknown = _lttng_event_create(chan, &ev, filter,
-						desc,
-						ev.instrumentation);
-		WARN_ON_ONCE(!chan->sc_unknown);
-		if (IS_ERR(chan->sc_unknown)) {
-			return PTR_ERR(chan->sc_unknown);
-		}
-	}
-
-	if (!chan->sc_compat_unknown) {
-		const struct lttng_event_desc *desc =
-			&__event_desc___compat_syscall_entry_unknown;
-
-		memset(&ev, 0, sizeof(ev));
-		strncpy(ev.name, desc->name, LTTNG_KERNEL_SYM_NAME_LEN);
-		ev.name[LTTNG_KERNEL_SYM_NAME_LEN - 1] = '\0';
-		ev.instrumentation = LTTNG_KERNEL_SYSCALL;
-		chan->sc_compat_unknown = _lttng_event_create(chan, &ev, filter,
-						desc,
-						ev.instrumentation);
-		WARN_ON_ONCE(!chan->sc_unknown);
-		if (IS_ERR(chan->sc_compat_unknown)) {
-			return PTR_ERR(chan->sc_compat_unknown);
-		}
-	}
-
-	if (!chan->compat_sc_exit_unknown) {
-		const struct lttng_event_desc *desc =
-			&__event_desc___compat_syscall_exit_unknown;
-
-		memset(&ev, 0, sizeof(ev));
-		strncpy(ev.name, desc->name, LTTNG_KERNEL_SYM_NAME_LEN);
-		ev.name[LTTNG_KERNEL_SYM_NAME_LEN - 1] = '\0';
-		ev.instrumentation = LTTNG_KERNEL_SYSCALL;
-		chan->compat_sc_exit_unknown = _lttng_event_create(chan, &ev,
-						filter, desc,
-						ev.instrumentation);
-		WARN_ON_ONCE(!chan->compat_sc_exit_unknown);
-		if (IS_ERR(chan->compat_sc_exit_unknown)) {
-			return PTR_ERR(chan->compat_sc_exit_unknown);
-		}
-	}
-
-	if (!chan->sc_exit_unknown) {
-		const struct lttng_event_desc *desc =
-			&__event_desc___syscall_exit_unknown;
-
-		memset(&ev, 0, sizeof(ev));
-		strncpy(ev.name, desc->name, LTTNG_KERNEL_SYM_NAME_LEN);
-		ev.name[LTTNG_KERNEL_SYM_NAME_LEN - 1] = '\0';
-		ev.instrumentation = LTTNG_KERNEL_SYSCALL;
-		chan->sc_exit_unknown = _lttng_event_create(chan, &ev, filter,
-						desc, ev.instrumentation);
-		WARN_ON_ONCE(!chan->sc_exit_unknown);
-		if (IS_ERR(chan->sc_exit_unknown)) {
-			return PTR_ERR(chan->sc_exit_unknown);
-		}
+		ret = fill_table(chan, filter, type);
+		if (ret)
+			return ret;
 	}
-
-	ret = fill_table(sc_table, ARRAY_SIZE(sc_table),
-			chan->sc_table, chan, filter, SC_TYPE_ENTRY);
-	if (ret)
-		return ret;
-	ret = fill_table(sc_exit_table, ARRAY_SIZE(sc_exit_table),
-			chan->sc_exit_table, chan, filter, SC_TYPE_EXIT);
-	if (ret)
-		return ret;
-
-#ifdef CONFIG_COMPAT
-	ret = fill_table(compat_sc_table, ARRAY_SIZE(compat_sc_table),
-			chan->compat_sc_table, chan, filter,
-			SC_TYPE_COMPAT_ENTRY);
-	if (ret)
-		return ret;
-	ret = fill_table(compat_sc_exit_table, ARRAY_SIZE(compat_sc_exit_table),
-			chan->compat_sc_exit_table, chan, filter,
-			SC_TYPE_COMPAT_EXIT);
-	if (ret)
-		return ret;
-#endif
 	if (!chan->sys_enter_registered) {
 		ret = lttng_wrapper_tracepoint_probe_register("sys_enter",
 				(void *) syscall_entry_probe, chan);
@@ -914,7 +1083,7 @@ int lttng_syscalls_unregister(struct lttng_channel *chan)
 {
 	int ret;
 
-	if (!chan->sc_table)
+	if (!chan->sc_dispatch)
 		return 0;
 	if (chan->sys_enter_registered) {
 		ret = lttng_wrapper_tracepoint_probe_unregister("sys_exit",
@@ -931,87 +1100,65 @@ int lttng_syscalls_unregister(struct lttng_channel *chan)
 		chan->sys_exit_registered = 0;
 	}
 	/* lttng_event destroy will be performed by lttng_session_destroy() */
-	kfree(chan->sc_table);
-	kfree(chan->sc_exit_table);
-#ifdef CONFIG_COMPAT
-	kfree(chan->compat_sc_table);
-	kfree(chan->compat_sc_exit_table);
-#endif
+	kfree(chan->sc_dispatch);
+	lttng_kvfree(chan->sc_stash);
 	kfree(chan->sc_filter);
 	return 0;
 }
 
 static
-int get_syscall_nr(const char *syscall_name)
+uint32_t get_sc_tables_len(void)
 {
-	int syscall_nr = -1;
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(sc_table); i++) {
-		const struct trace_syscall_entry *entry;
-		const char *it_name;
-
-		entry = &sc_table[i];
-		if (!entry->desc)
-			continue;
-		it_name = entry->desc->name;
-		it_name += strlen(SYSCALL_ENTRY_STR);
-		if (!strcmp(syscall_name, it_name)) {
-			syscall_nr = i;
-			break;
-		}
-	}
-	return syscall_nr;
+	return ARRAY_SIZE(sc_table) + ARRAY_SIZE(compat_sc_table);
 }
 
+/*
+ * Returns the filter bitmap holding the bit of a system call event, or
+ * NULL for unknown system calls, which are not filtered individually.
+ */
 static
-int get_compat_syscall_nr(const char *syscall_name)
+unsigned long *syscall_filter_bitmap(struct lttng_syscall_filter *filter,
+		const struct lttng_event *event, unsigned int *bit)
 {
-	int syscall_nr = -1;
-	int i;
+	unsigned int index = event->u.syscall.index;
+	enum sc_type type;
 
-	for (i = 0; i < ARRAY_SIZE(compat_sc_table); i++) {
-		const struct trace_syscall_entry *entry;
-		const char *it_name;
+	for (type = 0; type < ARRAY_SIZE(sc_dispatch_layout); type++) {
+		const struct sc_dispatch_layout *layout =
+			&sc_dispatch_layout[type];
 
-		entry = &compat_sc_table[i];
-		if (!entry->desc)
+		if (index < layout->offset
+				|| index >= layout->offset + layout->len)
 			continue;
-		it_name = entry->desc->name;
-		it_name += strlen(COMPAT_SYSCALL_ENTRY_STR);
-		if (!strcmp(syscall_name, it_name)) {
-			syscall_nr = i;
-			break;
+		*bit = index - layout->offset;
+		switch (type) {
+		case SC_TYPE_ENTRY:
+			return *bit < NR_syscalls ? filter->sc : NULL;
+		case SC_TYPE_EXIT:
+			return *bit < NR_syscalls ? filter->sc_exit : NULL;
+		case SC_TYPE_COMPAT_ENTRY:
+			return *bit < NR_compat_syscalls ?
+				filter->sc_compat : NULL;
+		case SC_TYPE_COMPAT_EXIT:
+			return *bit < NR_compat_syscalls ?
+				filter->sc_compat_exit : NULL;
 		}
 	}
-	return syscall_nr;
-}
-
-static
-uint32_t get_sc_tables_len(void)
-{
-	return ARRAY_SIZE(sc_table) + ARRAY_SIZE(compat_sc_table);
+	return NULL;
 }
 
+/*
+ * Should be called with sessions lock held.
+ */
 int lttng_syscall_filter_enable(struct lttng_channel *chan,
-		const char *name)
+		struct lttng_event *event)
 {
-	int syscall_nr, compat_syscall_nr, ret;
 	struct lttng_syscall_filter *filter;
+	unsigned long *bitmap;
+	unsigned int bit;
+	int ret;
 
-	WARN_ON_ONCE(!chan->sc_table);
-
-	if (!name) {
-		/* Enable all system calls by removing filter */
-		if (chan->sc_filter) {
-			filter = chan->sc_filter;
-			rcu_assign_pointer(chan->sc_filter, NULL);
-			synchronize_trace();
-			kfree(filter);
-		}
-		chan->syscall_all = 1;
-		return 0;
-	}
+	WARN_ON_ONCE(!chan->sc_dispatch);
 
 	if (!chan->sc_filter) {
 		if (chan->syscall_all) {
@@ -1027,26 +1174,16 @@ int lttng_syscall_filter_enable(struct lttng_channel *chan,
 	} else {
 		filter = chan->sc_filter;
 	}
-	syscall_nr = get_syscall_nr(name);
-	compat_syscall_nr = get_compat_syscall_nr(name);
-	if (syscall_nr < 0 && compat_syscall_nr < 0) {
+	bitmap = syscall_filter_bitmap(filter, event, &bit);
+	if (!bitmap) {
 		ret = -ENOENT;
 		goto error;
 	}
-	if (syscall_nr >= 0) {
-		if (test_bit(syscall_nr, filter->sc)) {
-			ret = -EEXIST;
-			goto error;
-		}
-		bitmap_set(filter->sc, syscall_nr, 1);
-	}
-	if (compat_syscall_nr >= 0) {
-		if (test_bit(compat_syscall_nr, filter->sc_compat)) {
-			ret = -EEXIST;
-			goto error;
-		}
-		bitmap_set(filter->sc_compat, compat_syscall_nr, 1);
+	if (test_bit(bit, bitmap)) {
+		ret = -EEXIST;
+		goto error;
 	}
+	bitmap_set(bitmap, bit, 1);
 	if (!chan->sc_filter)
 		rcu_assign_pointer(chan->sc_filter, filter);
 	return 0;
@@ -1057,13 +1194,18 @@ error:
 	return ret;
 }
 
+/*
+ * Should be called with sessions lock held.
+ */
 int lttng_syscall_filter_disable(struct lttng_channel *chan,
-		const char *name)
+		struct lttng_event *event)
 {
-	int syscall_nr, compat_syscall_nr, ret;
 	struct lttng_syscall_filter *filter;
+	unsigned long *bitmap;
+	unsigned int bit;
+	int ret;
 
-	WARN_ON_ONCE(!chan->sc_table);
+	WARN_ON_ONCE(!chan->sc_dispatch);
 
 	if (!chan->sc_filter) {
 		if (!chan->syscall_all)
@@ -1075,45 +1217,21 @@ int lttng_syscall_filter_disable(struct lttng_channel *chan,
 		/* Trace all system calls, then apply disable. */
 		bitmap_set(filter->sc, 0, NR_syscalls);
 		bitmap_set(filter->sc_compat, 0, NR_compat_syscalls);
+		bitmap_set(filter->sc_exit, 0, NR_syscalls);
+		bitmap_set(filter->sc_compat_exit, 0, NR_compat_syscalls);
 	} else {
 		filter = chan->sc_filter;
 	}
-
-	if (!name) {
-		/* Fail if all syscalls are already disabled. */
-		if (bitmap_empty(filter->sc, NR_syscalls)
-			&& bitmap_empty(filter->sc_compat,
-				NR_compat_syscalls)) {
-			ret = -EEXIST;
-			goto error;
-		}
-
-		/* Disable all system calls */
-		bitmap_clear(filter->sc, 0, NR_syscalls);
-		bitmap_clear(filter->sc_compat, 0, NR_compat_syscalls);
-		goto apply_filter;
-	}
-	syscall_nr = get_syscall_nr(name);
-	compat_syscall_nr = get_compat_syscall_nr(name);
-	if (syscall_nr < 0 && compat_syscall_nr < 0) {
+	bitmap = syscall_filter_bitmap(filter, event, &bit);
+	if (!bitmap) {
 		ret = -ENOENT;
 		goto error;
 	}
-	if (syscall_nr >= 0) {
-		if (!test_bit(syscall_nr, filter->sc)) {
-			ret = -EEXIST;
-			goto error;
-		}
-		bitmap_clear(filter->sc, syscall_nr, 1);
-	}
-	if (compat_syscall_nr >= 0) {
-		if (!test_bit(compat_syscall_nr, filter->sc_compat)) {
-			ret = -EEXIST;
-			goto error;
-		}
-		bitmap_clear(filter->sc_compat, compat_syscall_nr, 1);
+	if (!test_bit(bit, bitmap)) {
+		ret = -EEXIST;
+		goto error;
 	}
-apply_filter:
+	bitmap_clear(bitmap, bit, 1);
 	if (!chan->sc_filter)
 		rcu_assign_pointer(chan->sc_filter, filter);
 	chan->syscall_all = 0;
@@ -1236,6 +1354,17 @@ const struct file_operations lttng_syscall_list_fops = {
 	.release = seq_release,
 };
 
+/* Compat system call events are only created on CONFIG_COMPAT kernels. */
+static
+int compat_syscalls_traced(struct lttng_channel *channel)
+{
+#ifdef CONFIG_COMPAT
+	return channel->sc_dispatch != NULL;
+#else
+	return 0;
+#endif
+}
+
 long lttng_channel_syscall_mask(struct lttng_channel *channel,
 		struct lttng_kernel_syscall_mask __user *usyscall_mask)
 {
@@ -1261,7 +1390,7 @@ long lttng_channel_syscall_mask(struct lttng_channel *channel,
 	for (bit = 0; bit < ARRAY_SIZE(sc_table); bit++) {
 		char state;
 
-		if (channel->sc_table) {
+		if (channel->sc_dispatch) {
 			if (filter)
 				state = test_bit(bit, filter->sc);
 			else
@@ -1274,7 +1403,7 @@ long lttng_channel_syscall_mask(struct lttng_channel *channel,
 	for (; bit < sc_tables_len; bit++) {
 		char state;
 
-		if (channel->compat_sc_table) {
+		if (compat_syscalls_traced(channel)) {
 			if (filter)
 				state = test_bit(bit - ARRAY_SIZE(sc_table),
 						filter->sc_compat);
@@ -1291,6 +1420,79 @@ long lttng_channel_syscall_mask(struct lttng_channel *channel,
 	return ret;
 }
 
+/*
+ * Apply a batch of system call enable or disable operations. The mask
+ * acts as a channel enabler for the system call events: the events set
+ * in the batch are marked as enabled, or no longer enabled, by the mask,
+ * and a single enabler sync then registers or unregisters them, as for
+ * events enabled by name. An event which is also matched by an enabled
+ * enabler stays enabled when disabled through the mask.
+ */
+long lttng_channel_syscall_mask_update(struct lttng_channel *channel,
+		struct lttng_kernel_syscall_mask_update __user *uupdate)
+{
+	uint32_t len, op, sc_tables_len, bitmask_len;
+	enum sc_type type;
+	char *tmp_mask;
+	long ret = 0;
+
+	if (get_user(len, &uupdate->len) || get_user(op, &uupdate->op))
+		return -EFAULT;
+	if (op != LTTNG_KERNEL_SYSCALL_MASK_ENABLE
+			&& op != LTTNG_KERNEL_SYSCALL_MASK_DISABLE)
+		return -EINVAL;
+	sc_tables_len = get_sc_tables_len();
+	if (len != sc_tables_len)
+		return -EINVAL;
+	bitmask_len = ALIGN(sc_tables_len, 8) >> 3;
+	tmp_mask = kmalloc(2 * bitmask_len, GFP_KERNEL);
+	if (!tmp_mask)
+		return -ENOMEM;
+	if (copy_from_user(tmp_mask, uupdate->mask, 2 * bitmask_len)) {
+		ret = -EFAULT;
+		goto end_free_mask;
+	}
+
+	lttng_lock_sessions();
+	if (!channel->sc_dispatch) {
+		/* System call tracing not set up for this channel. */
+		ret = -EINVAL;
+		goto end_unlock;
+	}
+	for (type = 0; type < ARRAY_SIZE(sc_dispatch_layout); type++) {
+		const struct sc_dispatch_layout *layout =
+			&sc_dispatch_layout[type];
+		const char *mask = tmp_mask;
+		size_t start = 0, nr_bits = ARRAY_SIZE(sc_table), i;
+
+		if (type == SC_TYPE_EXIT || type == SC_TYPE_COMPAT_EXIT)
+			mask += bitmask_len;
+		if (layout->compat) {
+			start = ARRAY_SIZE(sc_table);
+			nr_bits = ARRAY_SIZE(compat_sc_table);
+		}
+		for (i = 0; i < layout->len && i < nr_bits; i++) {
+			struct lttng_event *event;
+			char state;
+
+			event = channel->sc_dispatch[layout->offset + i].event;
+			if (!event)
+				continue;
+			bt_bitfield_read_be(mask, char, start + i, 1, &state);
+			if (!state)
+				continue;
+			event->u.syscall.masked =
+				(op == LTTNG_KERNEL_SYSCALL_MASK_ENABLE);
+		}
+	}
+	lttng_session_lazy_sync_enablers(channel->session);
+end_unlock:
+	lttng_unlock_sessions();
+end_free_mask:
+	kfree(tmp_mask);
+	return ret;
+}
+
 int lttng_abi_syscall_list(void)
 {
 	struct file *syscall_list_file;
@@ -38,6 +38,23 @@
 
 #define __LTTNG_NULL_STRING	"(null)"
 
+/*
+ * Field selection. The size, alignment and serialization stages walk
+ * the written fields in declaration order, counting them in
+ * __field_index, and skip those not selected by the event payload
+ * projection mask passed as __field_mask. Fields nested within a custom
+ * field are recorded whenever the enclosing custom field is, so they get
+ * a fresh, fully selected scope. The filter stack preparation stage uses
+ * the same scheme with the mask of fields read by the event filters.
+ */
+#define __LTTNG_FIELD_SELECTED()					\
+	lttng_event_field_selected(__field_mask, __field_index++)
+
+#define __LTTNG_FIELD_NESTED_SCOPE					\
+	uint64_t __field_mask __attribute__((unused)) =			\
+		LTTNG_EVENT_FIELD_MASK_ALL;				\
+	unsigned int __field_index __attribute__((unused)) = 0;
+
 /*
  * Macro declarations used for all stages.
  */
@@ -472,13 +489,17 @@ static void __event_probe__##_name(void *__data);
 
 #undef _ctf_integer_ext
 #define _ctf_integer_ext(_type, _item, _src, _byte_order, _base, _user, _nowrite) \
-	__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_type)); \
-	__event_len += sizeof(_type);
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_type)); \
+		__event_len += sizeof(_type);				\
+	}
 
 #undef _ctf_array_encoded
 #define _ctf_array_encoded(_type, _item, _src, _length, _encoding, _user, _nowrite) \
-	__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_type)); \
-	__event_len += sizeof(_type) * (_length);
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_type)); \
+		__event_len += sizeof(_type) * (_length);		\
+	}
 
 #undef _ctf_array_bitfield
 #define _ctf_array_bitfield(_type, _item, _src, _length, _user, _nowrite) \
@@ -487,12 +508,12 @@ static void __event_probe__##_name(void *__data);
 #undef _ctf_sequence_encoded
 #define _ctf_sequence_encoded(_type, _item, _src, _length_type,			\
 			_src_length, _encoding, _byte_order, _base, _user, _nowrite) \
-	__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_length_type)); \
-	__event_len += sizeof(_length_type);				       \
-	__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_type)); \
-	{										\
+	if (__LTTNG_FIELD_SELECTED()) {						\
 		size_t __seqlen = (_src_length);					\
 											\
+		__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_length_type)); \
+		__event_len += sizeof(_length_type);					\
+		__event_len += lib_ring_buffer_align(__event_len, lttng_alignof(_type)); \
 		if (unlikely(++this_cpu_ptr(&lttng_dynamic_len_stack)->offset >= LTTNG_DYNAMIC_LEN_STACK_SIZE)) \
 			goto error;							\
 		barrier();	/* reserve before use. */				\
@@ -513,15 +534,17 @@ static void __event_probe__##_name(void *__data);
  */
 #undef _ctf_string
 #define _ctf_string(_item, _src, _user, _nowrite)			       \
-	if (unlikely(++this_cpu_ptr(&lttng_dynamic_len_stack)->offset >= LTTNG_DYNAMIC_LEN_STACK_SIZE)) \
-		goto error;						       \
-	barrier();	/* reserve before use. */			       \
-	if (_user) {							       \
-		__event_len += this_cpu_ptr(&lttng_dynamic_len_stack)->stack[this_cpu_ptr(&lttng_dynamic_len_stack)->offset - 1] = \
-			max_t(size_t, lttng_strlen_user_inatomic(_src), 1);    \
-	} else {							       \
-		__event_len += this_cpu_ptr(&lttng_dynamic_len_stack)->stack[this_cpu_ptr(&lttng_dynamic_len_stack)->offset - 1] = \
-			strlen((_src) ? (_src) : __LTTNG_NULL_STRING) + 1; \
+	if (__LTTNG_FIELD_SELECTED()) {					       \
+		if (unlikely(++this_cpu_ptr(&lttng_dynamic_len_stack)->offset >= LTTNG_DYNAMIC_LEN_STACK_SIZE)) \
+			goto error;					       \
+		barrier();	/* reserve before use. */		       \
+		if (_user) {						       \
+			__event_len += this_cpu_ptr(&lttng_dynamic_len_stack)->stack[this_cpu_ptr(&lttng_dynamic_len_stack)->offset - 1] = \
+				max_t(size_t, lttng_strlen_user_inatomic(_src), 1); \
+		} else {						       \
+			__event_len += this_cpu_ptr(&lttng_dynamic_len_stack)->stack[this_cpu_ptr(&lttng_dynamic_len_stack)->offset - 1] = \
+				strlen((_src) ? (_src) : __LTTNG_NULL_STRING) + 1; \
+		}							       \
 	}
 
 #undef _ctf_enum
@@ -534,7 +557,8 @@ static void __event_probe__##_name(void *__data);
 
 #undef ctf_custom_field
 #define ctf_custom_field(_type, _item, _code)				\
-	{								\
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__LTTNG_FIELD_NESTED_SCOPE				\
 		_code							\
 	}
 
@@ -552,10 +576,12 @@ static void __event_probe__##_name(void *__data);
 
 #undef LTTNG_TRACEPOINT_EVENT_CLASS_CODE
 #define LTTNG_TRACEPOINT_EVENT_CLASS_CODE(_name, _proto, _args, _locvar, _code_pre, _fields, _code_post) \
-static inline ssize_t __event_get_size__##_name(void *__tp_locvar, _proto)     \
+static inline ssize_t __event_get_size__##_name(void *__tp_locvar,	      \
+		uint64_t __field_mask, _proto)				      \
 {									      \
 	size_t __event_len = 0;						      \
 	unsigned int __dynamic_len_idx __attribute__((unused)) = 0;	      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
 	struct { _locvar } *tp_locvar __attribute__((unused)) = __tp_locvar;  \
 									      \
 	_fields								      \
@@ -568,10 +594,12 @@ error:									      \
 
 #undef LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS
 #define LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS(_name, _locvar, _code_pre, _fields, _code_post) \
-static inline ssize_t __event_get_size__##_name(void *__tp_locvar)	      \
+static inline ssize_t __event_get_size__##_name(void *__tp_locvar,	      \
+		uint64_t __field_mask)					      \
 {									      \
 	size_t __event_len = 0;						      \
 	unsigned int __dynamic_len_idx __attribute__((unused)) = 0;	      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
 	struct { _locvar } *tp_locvar __attribute__((unused)) = __tp_locvar;  \
 									      \
 	_fields								      \
@@ -590,6 +618,11 @@ error:									      \
  *
  * Create static inline function that layout the filter stack data.
  * We make both write and nowrite data available to the filter.
+ *
+ * Only the fields read by the filters attached to the event (as recorded
+ * in its filter field mask at link time) are fetched; the slots of the
+ * other fields are skipped, keeping the stack layout expected by the
+ * field relocations.
  */
 
 /* Reset all macros within TRACEPOINT_EVENT */
@@ -695,17 +728,23 @@ error:									      \
 
 #undef _ctf_integer_ext
 #define _ctf_integer_ext(_type, _item, _user_src, _byte_order, _base, _user, _nowrite) \
-	_ctf_integer_ext_isuser##_user(_type, _item, _user_src, _byte_order, _base, _nowrite)
+	if (__LTTNG_FIELD_SELECTED()) {					       \
+		_ctf_integer_ext_isuser##_user(_type, _item, _user_src, _byte_order, _base, _nowrite) \
+	} else {							       \
+		__stack_data += sizeof(int64_t);			       \
+	}
 
 #undef _ctf_array_encoded
 #define _ctf_array_encoded(_type, _item, _src, _length, _encoding, _user, _nowrite) \
-	{								       \
+	if (__LTTNG_FIELD_SELECTED()) {					       \
 		unsigned long __ctf_tmp_ulong = (unsigned long) (_length);     \
 		const void *__ctf_tmp_ptr = (_src);			       \
 		memcpy(__stack_data, &__ctf_tmp_ulong, sizeof(unsigned long)); \
 		__stack_data += sizeof(unsigned long);			       \
 		memcpy(__stack_data, &__ctf_tmp_ptr, sizeof(void *));	       \
 		__stack_data += sizeof(void *);				       \
+	} else {							       \
+		__stack_data += sizeof(unsigned long) + sizeof(void *);	       \
 	}
 
 #undef _ctf_array_bitfield
@@ -715,13 +754,15 @@ error:									      \
 #undef _ctf_sequence_encoded
 #define _ctf_sequence_encoded(_type, _item, _src, _length_type,		       \
 			_src_length, _encoding, _byte_order, _base, _user, _nowrite) \
-	{								       \
+	if (__LTTNG_FIELD_SELECTED()) {					       \
 		unsigned long __ctf_tmp_ulong = (unsigned long) (_src_length); \
 		const void *__ctf_tmp_ptr = (_src);			       \
 		memcpy(__stack_data, &__ctf_tmp_ulong, sizeof(unsigned long)); \
 		__stack_data += sizeof(unsigned long);			       \
 		memcpy(__stack_data, &__ctf_tmp_ptr, sizeof(void *));	       \
 		__stack_data += sizeof(void *);				       \
+	} else {							       \
+		__stack_data += sizeof(unsigned long) + sizeof(void *);	       \
 	}
 
 #undef _ctf_sequence_bitfield
@@ -733,17 +774,24 @@ error:									      \
 
 #undef _ctf_string
 #define _ctf_string(_item, _src, _user, _nowrite)			       \
-	{								       \
+	if (__LTTNG_FIELD_SELECTED()) {					       \
 		const void *__ctf_tmp_ptr =				       \
 			((_src) ? (_src) : __LTTNG_NULL_STRING);	       \
 		memcpy(__stack_data, &__ctf_tmp_ptr, sizeof(void *));	       \
 		__stack_data += sizeof(void *);				       \
+	} else {							       \
+		__stack_data += sizeof(void *);				       \
 	}
 
 #undef _ctf_enum
 #define _ctf_enum(_name, _type, _item, _src, _user, _nowrite)		       \
 	_ctf_integer_ext(_type, _item, _src, __BYTE_ORDER, 10, _user, _nowrite)
 
+/* Custom fields have no filter stack slot, but keep field indexes in sync. */
+#undef ctf_custom_field
+#define ctf_custom_field(_type, _item, _code)				       \
+	__field_index++;
+
 #undef TP_PROTO
 #define TP_PROTO(...) __VA_ARGS__
 
@@ -757,8 +805,9 @@ error:									      \
 #define LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS(_name, _locvar, _code_pre, _fields, _code_post) \
 static inline								      \
 void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
-		void *__tp_locvar)					      \
+		uint64_t __field_mask, void *__tp_locvar)		      \
 {									      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
 	struct { _locvar } *tp_locvar __attribute__((unused)) = __tp_locvar;  \
 									      \
 	_fields								      \
@@ -768,8 +817,9 @@ void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
 #define LTTNG_TRACEPOINT_EVENT_CLASS_CODE(_name, _proto, _args, _locvar, _code_pre, _fields, _code_post) \
 static inline								      \
 void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
-		void *__tp_locvar, _proto)				      \
+		uint64_t __field_mask, void *__tp_locvar, _proto)	      \
 {									      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
 	struct { _locvar } *tp_locvar __attribute__((unused)) = __tp_locvar;  \
 									      \
 	_fields								      \
@@ -777,6 +827,91 @@ void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
 
 #include TRACE_INCLUDE(TRACE_INCLUDE_FILE)
 
+/*
+ * Stage 4.2 of tracepoint event generation.
+ *
+ * Create the function returning the mask of fields computed from
+ * TP_locvar, and thus from the TP_code_pre code. Filters reading none
+ * of those fields are evaluated before TP_code_pre, skipping it (and
+ * TP_code_post) for discarded events. Field source and length
+ * expressions are matched on their text, so this folds to a constant.
+ */
+
+/* Reset all macros within TRACEPOINT_EVENT */
+#include <probes/lttng-events-reset.h>
+#include <probes/lttng-events-write.h>
+#include <probes/lttng-events-nowrite.h>
+
+#undef __LTTNG_FIELD_LOCVAR
+#define __LTTNG_FIELD_LOCVAR(_src_text)					       \
+	if (__builtin_strstr(_src_text, "tp_locvar")) {			       \
+		if (__field_index < LTTNG_EVENT_FIELD_MASK_BITS)	       \
+			__mask |= 1ULL << __field_index;		       \
+		else							       \
+			__mask = LTTNG_EVENT_FIELD_MASK_ALL;		       \
+	}								       \
+	__field_index++;
+
+#undef _ctf_integer_ext
+#define _ctf_integer_ext(_type, _item, _user_src, _byte_order, _base, _user, _nowrite) \
+	__LTTNG_FIELD_LOCVAR(#_user_src)
+
+#undef _ctf_array_encoded
+#define _ctf_array_encoded(_type, _item, _src, _length, _encoding, _user, _nowrite) \
+	__LTTNG_FIELD_LOCVAR(#_src " " #_length)
+
+#undef _ctf_array_bitfield
+#define _ctf_array_bitfield(_type, _item, _src, _length, _user, _nowrite) \
+	_ctf_array_encoded(_type, _item, _src, _length, none, _user, _nowrite)
+
+#undef _ctf_sequence_encoded
+#define _ctf_sequence_encoded(_type, _item, _src, _length_type,		       \
+			_src_length, _encoding, _byte_order, _base, _user, _nowrite) \
+	__LTTNG_FIELD_LOCVAR(#_src " " #_src_length)
+
+#undef _ctf_sequence_bitfield
+#define _ctf_sequence_bitfield(_type, _item, _src,		\
+			_length_type, _src_length,		\
+			_user, _nowrite)			\
+	_ctf_sequence_encoded(_type, _item, _src, _length_type, _src_length, \
+		none, __LITTLE_ENDIAN, 10, _user, _nowrite)
+
+#undef _ctf_string
+#define _ctf_string(_item, _src, _user, _nowrite)			       \
+	__LTTNG_FIELD_LOCVAR(#_src)
+
+#undef _ctf_enum
+#define _ctf_enum(_name, _type, _item, _src, _user, _nowrite)		       \
+	_ctf_integer_ext(_type, _item, _src, __BYTE_ORDER, 10, _user, _nowrite)
+
+/* Custom fields have no filter stack slot. */
+#undef ctf_custom_field
+#define ctf_custom_field(_type, _item, _code)				       \
+	__field_index++;
+
+#undef TP_FIELDS
+#define TP_FIELDS(...) __VA_ARGS__
+
+#undef LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS
+#define LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS(_name, _locvar, _code_pre, _fields, _code_post) \
+static inline								      \
+uint64_t __event_filter_locvar_mask__##_name(void)			      \
+{									      \
+	uint64_t __mask = 0;						      \
+	unsigned int __field_index = 0;					      \
+									      \
+	_fields								      \
+	return __mask;							      \
+}
+
+#undef LTTNG_TRACEPOINT_EVENT_CLASS_CODE
+#define LTTNG_TRACEPOINT_EVENT_CLASS_CODE(_name, _proto, _args, _locvar, _code_pre, _fields, _code_post) \
+	LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS(_name, _locvar, _code_pre, PARAMS(_fields), _code_post)
+
+#include TRACE_INCLUDE(TRACE_INCLUDE_FILE)
+
+#undef __LTTNG_FIELD_LOCVAR
+
 /*
  * Stage 5 of the trace events.
  *
@@ -789,11 +924,15 @@ void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
 
 #undef _ctf_integer_ext
 #define _ctf_integer_ext(_type, _item, _src, _byte_order, _base, _user, _nowrite) \
-	__event_align = max_t(size_t, __event_align, lttng_alignof(_type));
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__event_align = max_t(size_t, __event_align, lttng_alignof(_type)); \
+	}
 
 #undef _ctf_array_encoded
 #define _ctf_array_encoded(_type, _item, _src, _length, _encoding, _user, _nowrite) \
-	__event_align = max_t(size_t, __event_align, lttng_alignof(_type));
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__event_align = max_t(size_t, __event_align, lttng_alignof(_type)); \
+	}
 
 #undef _ctf_array_bitfield
 #define _ctf_array_bitfield(_type, _item, _src, _length, _user, _nowrite) \
@@ -802,8 +941,10 @@ void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
 #undef _ctf_sequence_encoded
 #define _ctf_sequence_encoded(_type, _item, _src, _length_type,			\
 			_src_length, _encoding, _byte_order, _base, _user, _nowrite) \
-	__event_align = max_t(size_t, __event_align, lttng_alignof(_length_type)); \
-	__event_align = max_t(size_t, __event_align, lttng_alignof(_type));
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__event_align = max_t(size_t, __event_align, lttng_alignof(_length_type)); \
+		__event_align = max_t(size_t, __event_align, lttng_alignof(_type)); \
+	}
 
 #undef _ctf_sequence_bitfield
 #define _ctf_sequence_bitfield(_type, _item, _src,		\
@@ -813,7 +954,8 @@ void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
 		none, __LITTLE_ENDIAN, 10, _user, _nowrite)
 
 #undef _ctf_string
-#define _ctf_string(_item, _src, _user, _nowrite)
+#define _ctf_string(_item, _src, _user, _nowrite)			\
+	__field_index++;
 
 #undef _ctf_enum
 #define _ctf_enum(_name, _type, _item, _src, _user, _nowrite)	\
@@ -833,7 +975,11 @@ void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
 #define TP_locvar(...)	__VA_ARGS__
 
 #undef ctf_custom_field
-#define ctf_custom_field(_type, _item, _code)		_code
+#define ctf_custom_field(_type, _item, _code)				\
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__LTTNG_FIELD_NESTED_SCOPE				\
+		_code							\
+	}
 
 #undef ctf_custom_code
 #define ctf_custom_code(...)						\
@@ -843,9 +989,11 @@ void __event_prepare_filter_stack__##_name(char *__stack_data,		      \
 
 #undef LTTNG_TRACEPOINT_EVENT_CLASS_CODE
 #define LTTNG_TRACEPOINT_EVENT_CLASS_CODE(_name, _proto, _args, _locvar, _code_pre, _fields, _code_post) \
-static inline size_t __event_get_align__##_name(void *__tp_locvar, _proto)    \
+static inline size_t __event_get_align__##_name(void *__tp_locvar,	      \
+		uint64_t __field_mask, _proto)				      \
 {									      \
 	size_t __event_align = 1;					      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
 	struct { _locvar } *tp_locvar __attribute__((unused)) = __tp_locvar;  \
 									      \
 	_fields								      \
@@ -854,9 +1002,11 @@ static inline size_t __event_get_align__##_name(void *__tp_locvar, _proto)    \
 
 #undef LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS
 #define LTTNG_TRACEPOINT_EVENT_CLASS_CODE_NOARGS(_name, _locvar, _code_pre, _fields, _code_post) \
-static inline size_t __event_get_align__##_name(void *__tp_locvar)	      \
+static inline size_t __event_get_align__##_name(void *__tp_locvar,	      \
+		uint64_t __field_mask)					      \
 {									      \
 	size_t __event_align = 1;					      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
 	struct { _locvar } *tp_locvar __attribute__((unused)) = __tp_locvar;  \
 									      \
 	_fields								      \
@@ -903,25 +1053,31 @@ static inline size_t __event_get_align__##_name(void *__tp_locvar)	      \
 
 #undef _ctf_integer_ext
 #define _ctf_integer_ext(_type, _item, _user_src, _byte_order, _base, _user, _nowrite) \
-	_ctf_integer_ext_isuser##_user(_type, _item, _user_src, _byte_order, _base, _nowrite)
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		_ctf_integer_ext_isuser##_user(_type, _item, _user_src, _byte_order, _base, _nowrite) \
+	}
 
 #undef _ctf_array_encoded
 #define _ctf_array_encoded(_type, _item, _src, _length, _encoding, _user, _nowrite) \
-	lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
-	if (_user) {							\
-		__chan->ops->event_write_from_user(&__ctx, _src, sizeof(_type) * (_length)); \
-	} else {							\
-		__chan->ops->event_write(&__ctx, _src, sizeof(_type) * (_length)); \
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
+		if (_user) {							\
+			__chan->ops->event_write_from_user(&__ctx, _src, sizeof(_type) * (_length)); \
+		} else {							\
+			__chan->ops->event_write(&__ctx, _src, sizeof(_type) * (_length)); \
+		}							\
 	}
 
 #if (__BYTE_ORDER == __LITTLE_ENDIAN)
 #undef _ctf_array_bitfield
 #define _ctf_array_bitfield(_type, _item, _src, _length, _user, _nowrite) \
-	lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
-	if (_user) {							\
-		__chan->ops->event_write_from_user(&__ctx, _src, sizeof(_type) * (_length)); \
-	} else {							\
-		__chan->ops->event_write(&__ctx, _src, sizeof(_type) * (_length)); \
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
+		if (_user) {							\
+			__chan->ops->event_write_from_user(&__ctx, _src, sizeof(_type) * (_length)); \
+		} else {							\
+			__chan->ops->event_write(&__ctx, _src, sizeof(_type) * (_length)); \
+		}							\
 	}
 #else /* #if (__BYTE_ORDER == __LITTLE_ENDIAN) */
 /*
@@ -929,35 +1085,37 @@ static inline size_t __event_get_align__##_name(void *__tp_locvar)	      \
  */
 #undef _ctf_array_bitfield
 #define _ctf_array_bitfield(_type, _item, _src, _length, _user, _nowrite) \
-	lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
-	{								\
-		size_t _i;						\
-									\
-		for (_i = 0; _i < (_length); _i++) {			\
-			_type _tmp;					\
-									\
-			if (_user) {					\
-				if (get_user(_tmp, (_type *) _src + _i)) \
-					_tmp = 0;			\
-			} else {					\
-				_tmp = ((_type *) _src)[_i];		\
-			}						\
-			switch (sizeof(_type)) {			\
-			case 1:						\
-				break;					\
-			case 2:						\
-				_tmp = cpu_to_le16(_tmp);		\
-				break;					\
-			case 4:						\
-				_tmp = cpu_to_le32(_tmp);		\
-				break;					\
-			case 8:						\
-				_tmp = cpu_to_le64(_tmp);		\
-				break;					\
-			default:					\
-				BUG_ON(1);				\
-			}						\
-			__chan->ops->event_write(&__ctx, &_tmp, sizeof(_type)); \
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
+		{								\
+			size_t _i;						\
+										\
+			for (_i = 0; _i < (_length); _i++) {			\
+				_type _tmp;					\
+										\
+				if (_user) {					\
+					if (get_user(_tmp, (_type *) _src + _i)) \
+						_tmp = 0;			\
+				} else {					\
+					_tmp = ((_type *) _src)[_i];		\
+				}						\
+				switch (sizeof(_type)) {			\
+				case 1:						\
+					break;					\
+				case 2:						\
+					_tmp = cpu_to_le16(_tmp);		\
+					break;					\
+				case 4:						\
+					_tmp = cpu_to_le32(_tmp);		\
+					break;					\
+				case 8:						\
+					_tmp = cpu_to_le64(_tmp);		\
+					break;					\
+				default:					\
+					BUG_ON(1);				\
+				}						\
+				__chan->ops->event_write(&__ctx, &_tmp, sizeof(_type)); \
+			}							\
 		}							\
 	}
 #endif /* #else #if (__BYTE_ORDER == __LITTLE_ENDIAN) */
@@ -965,18 +1123,20 @@ static inline size_t __event_get_align__##_name(void *__tp_locvar)	      \
 #undef _ctf_sequence_encoded
 #define _ctf_sequence_encoded(_type, _item, _src, _length_type,		\
 			_src_length, _encoding, _byte_order, _base, _user, _nowrite) \
-	{								\
-		_length_type __tmpl = this_cpu_ptr(&lttng_dynamic_len_stack)->stack[__dynamic_len_idx]; \
-		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_length_type));\
-		__chan->ops->event_write(&__ctx, &__tmpl, sizeof(_length_type));\
-	}								\
-	lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
-	if (_user) {							\
-		__chan->ops->event_write_from_user(&__ctx, _src,	\
-			sizeof(_type) * __get_dynamic_len(dest));	\
-	} else {							\
-		__chan->ops->event_write(&__ctx, _src,			\
-			sizeof(_type) * __get_dynamic_len(dest));	\
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		{								\
+			_length_type __tmpl = this_cpu_ptr(&lttng_dynamic_len_stack)->stack[__dynamic_len_idx]; \
+			lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_length_type));\
+			__chan->ops->event_write(&__ctx, &__tmpl, sizeof(_length_type));\
+		}								\
+		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
+		if (_user) {							\
+			__chan->ops->event_write_from_user(&__ctx, _src,	\
+				sizeof(_type) * __get_dynamic_len(dest));	\
+		} else {							\
+			__chan->ops->event_write(&__ctx, _src,			\
+				sizeof(_type) * __get_dynamic_len(dest));	\
+		}							\
 	}
 
 #if (__BYTE_ORDER == __LITTLE_ENDIAN)
@@ -984,18 +1144,20 @@ static inline size_t __event_get_align__##_name(void *__tp_locvar)	      \
 #define _ctf_sequence_bitfield(_type, _item, _src,		\
 			_length_type, _src_length,		\
 			_user, _nowrite)			\
-	{								\
-		_length_type __tmpl = this_cpu_ptr(&lttng_dynamic_len_stack)->stack[__dynamic_len_idx] * sizeof(_type) * CHAR_BIT; \
-		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_length_type));\
-		__chan->ops->event_write(&__ctx, &__tmpl, sizeof(_length_type));\
-	}								\
-	lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
-	if (_user) {							\
-		__chan->ops->event_write_from_user(&__ctx, _src,	\
-			sizeof(_type) * __get_dynamic_len(dest));	\
-	} else {							\
-		__chan->ops->event_write(&__ctx, _src,			\
-			sizeof(_type) * __get_dynamic_len(dest));	\
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		{								\
+			_length_type __tmpl = this_cpu_ptr(&lttng_dynamic_len_stack)->stack[__dynamic_len_idx] * sizeof(_type) * CHAR_BIT; \
+			lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_length_type));\
+			__chan->ops->event_write(&__ctx, &__tmpl, sizeof(_length_type));\
+		}								\
+		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
+		if (_user) {							\
+			__chan->ops->event_write_from_user(&__ctx, _src,	\
+				sizeof(_type) * __get_dynamic_len(dest));	\
+		} else {							\
+			__chan->ops->event_write(&__ctx, _src,			\
+				sizeof(_type) * __get_dynamic_len(dest));	\
+		}							\
 	}
 #else /* #if (__BYTE_ORDER == __LITTLE_ENDIAN) */
 /*
@@ -1005,58 +1167,62 @@ static inline size_t __event_get_align__##_name(void *__tp_locvar)	      \
 #define _ctf_sequence_bitfield(_type, _item, _src,		\
 			_length_type, _src_length,		\
 			_user, _nowrite)			\
-	{							\
-		_length_type __tmpl = this_cpu_ptr(&lttng_dynamic_len_stack)->stack[__dynamic_len_idx] * sizeof(_type) * CHAR_BIT; \
-		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_length_type));\
-		__chan->ops->event_write(&__ctx, &__tmpl, sizeof(_length_type));\
-	}								\
-	lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
-	{								\
-		size_t _i, _length;					\
-									\
-		_length = __get_dynamic_len(dest);			\
-		for (_i = 0; _i < _length; _i++) {			\
-			_type _tmp;					\
-									\
-			if (_user) {					\
-				if (get_user(_tmp, (_type *) _src + _i)) \
-					_tmp = 0;			\
-			} else {					\
-				_tmp = ((_type *) _src)[_i];		\
-			}						\
-			switch (sizeof(_type)) {			\
-			case 1:						\
-				break;					\
-			case 2:						\
-				_tmp = cpu_to_le16(_tmp);		\
-				break;					\
-			case 4:						\
-				_tmp = cpu_to_le32(_tmp);		\
-				break;					\
-			case 8:						\
-				_tmp = cpu_to_le64(_tmp);		\
-				break;					\
-			default:					\
-				BUG_ON(1);				\
-			}						\
-			__chan->ops->event_write(&__ctx, &_tmp, sizeof(_type)); \
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		{							\
+			_length_type __tmpl = this_cpu_ptr(&lttng_dynamic_len_stack)->stack[__dynamic_len_idx] * sizeof(_type) * CHAR_BIT; \
+			lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_length_type));\
+			__chan->ops->event_write(&__ctx, &__tmpl, sizeof(_length_type));\
+		}								\
+		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));	\
+		{								\
+			size_t _i, _length;					\
+										\
+			_length = __get_dynamic_len(dest);			\
+			for (_i = 0; _i < _length; _i++) {			\
+				_type _tmp;					\
+										\
+				if (_user) {					\
+					if (get_user(_tmp, (_type *) _src + _i)) \
+						_tmp = 0;			\
+				} else {					\
+					_tmp = ((_type *) _src)[_i];		\
+				}						\
+				switch (sizeof(_type)) {			\
+				case 1:						\
+					break;					\
+				case 2:						\
+					_tmp = cpu_to_le16(_tmp);		\
+					break;					\
+				case 4:						\
+					_tmp = cpu_to_le32(_tmp);		\
+					break;					\
+				case 8:						\
+					_tmp = cpu_to_le64(_tmp);		\
+					break;					\
+				default:					\
+					BUG_ON(1);				\
+				}						\
+				__chan->ops->event_write(&__ctx, &_tmp, sizeof(_type)); \
+			}							\
 		}							\
 	}
 #endif /* #else #if (__BYTE_ORDER == __LITTLE_ENDIAN) */
 
 #undef _ctf_string
 #define _ctf_string(_item, _src, _user, _nowrite)		        \
-	if (_user) {							\
-		lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(*(_src))); \
-		__chan->ops->event_strcpy_from_user(&__ctx, _src,	\
-			__get_dynamic_len(dest));			\
-	} else {							\
-		const char *__ctf_tmp_string =				\
-			((_src) ? (_src) : __LTTNG_NULL_STRING);	\
-		lib_ring_buffer_align_ctx(&__ctx,			\
-			lttng_alignof(*__ctf_tmp_string));		\
-		__chan->ops->event_strcpy(&__ctx, __ctf_tmp_string,	\
-			__get_dynamic_len(dest));			\
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		if (_user) {							\
+			lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(*(_src))); \
+			__chan->ops->event_strcpy_from_user(&__ctx, _src,	\
+				__get_dynamic_len(dest));			\
+		} else {							\
+			const char *__ctf_tmp_string =				\
+				((_src) ? (_src) : __LTTNG_NULL_STRING);	\
+			lib_ring_buffer_align_ctx(&__ctx,			\
+				lttng_alignof(*__ctf_tmp_string));		\
+			__chan->ops->event_strcpy(&__ctx, __ctf_tmp_string,	\
+				__get_dynamic_len(dest));			\
+		}							\
 	}
 
 #undef _ctf_enum
@@ -1068,7 +1234,11 @@ static inline size_t __event_get_align__##_name(void *__tp_locvar)	      \
 	lib_ring_buffer_align_ctx(&__ctx, lttng_alignof(_type));
 
 #undef ctf_custom_field
-#define ctf_custom_field(_type, _item, _code)		_code
+#define ctf_custom_field(_type, _item, _code)				\
+	if (__LTTNG_FIELD_SELECTED()) {					\
+		__LTTNG_FIELD_NESTED_SCOPE				\
+		_code							\
+	}
 
 #undef ctf_custom_code
 #define ctf_custom_code(...)						\
@@ -1132,6 +1302,10 @@ static void __event_probe__##_name(void *__data, _proto)		      \
 	ssize_t __event_len;						      \
 	size_t __event_align;						      \
 	size_t __orig_dynamic_len_offset, __dynamic_len_idx __attribute__((unused)); \
+	uint64_t __field_mask = __event->field_mask;			      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
+	uint64_t __filter_mask;						      \
+	int __filter_done = 0;						      \
 	union {								      \
 		size_t __dynamic_len_removed[ARRAY_SIZE(__event_fields___##_name)];   \
 		char __filter_stack_data[2 * sizeof(unsigned long) * ARRAY_SIZE(__event_fields___##_name)]; \
@@ -1155,27 +1329,34 @@ static void __event_probe__##_name(void *__data, _proto)		      \
 		return;							      \
 	__orig_dynamic_len_offset = this_cpu_ptr(&lttng_dynamic_len_stack)->offset; \
 	__dynamic_len_idx = __orig_dynamic_len_offset;			      \
+	if (unlikely(!list_empty(&__event->bytecode_runtime_head))	      \
+			&& !READ_ONCE(__event->filter_after_code_pre)) {      \
+		/* Filters only read fields not computed by _code_pre. */     \
+		__filter_mask = READ_ONCE(__event->filter_field_mask)	      \
+				& ~__event->filter_locvar_mask;		      \
+		__event_prepare_filter_stack__##_name(__stackvar.__filter_stack_data, \
+				__filter_mask, tp_locvar, _args);	      \
+		if (likely(!lttng_event_filter_record(__event, &__lttng_probe_ctx, \
+				__stackvar.__filter_stack_data, __filter_mask))) \
+			goto __end;					      \
+		__filter_done = 1;					      \
+	}								      \
 	_code_pre							      \
-	if (unlikely(!list_empty(&__event->bytecode_runtime_head))) {	      \
-		struct lttng_bytecode_runtime *bc_runtime;		      \
-		int __filter_record = __event->has_enablers_without_bytecode; \
-									      \
+	if (unlikely(!list_empty(&__event->bytecode_runtime_head))	      \
+			&& !__filter_done) {				      \
+		__filter_mask = READ_ONCE(__event->filter_field_mask);	      \
 		__event_prepare_filter_stack__##_name(__stackvar.__filter_stack_data, \
-				tp_locvar, _args);				      \
-		lttng_list_for_each_entry_rcu(bc_runtime, &__event->bytecode_runtime_head, node) { \
-			if (unlikely(bc_runtime->filter(bc_runtime, &__lttng_probe_ctx,	      \
-					__stackvar.__filter_stack_data) & LTTNG_FILTER_RECORD_FLAG)) \
-				__filter_record = 1;			      \
-		}							      \
-		if (likely(!__filter_record))				      \
+				__filter_mask, tp_locvar, _args);	      \
+		if (likely(!lttng_event_filter_record(__event, &__lttng_probe_ctx, \
+				__stackvar.__filter_stack_data, __filter_mask))) \
 			goto __post;					      \
 	}								      \
-	__event_len = __event_get_size__##_name(tp_locvar, _args);	      \
+	__event_len = __event_get_size__##_name(tp_locvar, __field_mask, _args); \
 	if (unlikely(__event_len < 0)) {				      \
 		lib_ring_buffer_lost_event_too_big(__chan->chan);	      \
 		goto __post;						      \
 	}								      \
-	__event_align = __event_get_align__##_name(tp_locvar, _args);         \
+	__event_align = __event_get_align__##_name(tp_locvar, __field_mask, _args); \
 	lib_ring_buffer_ctx_init(&__ctx, __chan->chan, &__lttng_probe_ctx, __event_len,  \
 				 __event_align, -1);			      \
 	__ret = __chan->ops->event_reserve(&__ctx, __event->id);	      \
@@ -1185,6 +1366,7 @@ static void __event_probe__##_name(void *__data, _proto)		      \
 	__chan->ops->event_commit(&__ctx);				      \
 __post:									      \
 	_code_post							      \
+__end:									      \
 	barrier();	/* use before un-reserve. */			      \
 	this_cpu_ptr(&lttng_dynamic_len_stack)->offset = __orig_dynamic_len_offset; \
 	return;								      \
@@ -1206,6 +1388,10 @@ static void __event_probe__##_name(void *__data)			      \
 	ssize_t __event_len;						      \
 	size_t __event_align;						      \
 	size_t __orig_dynamic_len_offset, __dynamic_len_idx __attribute__((unused)); \
+	uint64_t __field_mask = __event->field_mask;			      \
+	unsigned int __field_index __attribute__((unused)) = 0;		      \
+	uint64_t __filter_mask;						      \
+	int __filter_done = 0;						      \
 	union {								      \
 		size_t __dynamic_len_removed[ARRAY_SIZE(__event_fields___##_name)];   \
 		char __filter_stack_data[2 * sizeof(unsigned long) * ARRAY_SIZE(__event_fields___##_name)]; \
@@ -1229,27 +1415,34 @@ static void __event_probe__##_name(void *__data)			      \
 		return;							      \
 	__orig_dynamic_len_offset = this_cpu_ptr(&lttng_dynamic_len_stack)->offset; \
 	__dynamic_len_idx = __orig_dynamic_len_offset;			      \
+	if (unlikely(!list_empty(&__event->bytecode_runtime_head))	      \
+			&& !READ_ONCE(__event->filter_after_code_pre)) {      \
+		/* Filters only read fields not computed by _code_pre. */     \
+		__filter_mask = READ_ONCE(__event->filter_field_mask)	      \
+				& ~__event->filter_locvar_mask;		      \
+		__event_prepare_filter_stack__##_name(__stackvar.__filter_stack_data, \
+				__filter_mask, tp_locvar);		      \
+		if (likely(!lttng_event_filter_record(__event, &__lttng_probe_ctx, \
+				__stackvar.__filter_stack_data, __filter_mask))) \
+			goto __end;					      \
+		__filter_done = 1;					      \
+	}								      \
 	_code_pre							      \
-	if (unlikely(!list_empty(&__event->bytecode_runtime_head))) {	      \
-		struct lttng_bytecode_runtime *bc_runtime;		      \
-		int __filter_record = __event->has_enablers_without_bytecode; \
-									      \
+	if (unlikely(!list_empty(&__event->bytecode_runtime_head))	      \
+			&& !__filter_done) {				      \
+		__filter_mask = READ_ONCE(__event->filter_field_mask);	      \
 		__event_prepare_filter_stack__##_name(__stackvar.__filter_stack_data, \
-				tp_locvar);				      \
-		lttng_list_for_each_entry_rcu(bc_runtime, &__event->bytecode_runtime_head, node) { \
-			if (unlikely(bc_runtime->filter(bc_runtime, &__lttng_probe_ctx,	\
-					__stackvar.__filter_stack_data) & LTTNG_FILTER_RECORD_FLAG)) \
-				__filter_record = 1;			      \
-		}							      \
-		if (likely(!__filter_record))				      \
+				__filter_mask, tp_locvar);		      \
+		if (likely(!lttng_event_filter_record(__event, &__lttng_probe_ctx, \
+				__stackvar.__filter_stack_data, __filter_mask))) \
 			goto __post;					      \
 	}								      \
-	__event_len = __event_get_size__##_name(tp_locvar);		      \
+	__event_len = __event_get_size__##_name(tp_locvar, __field_mask);     \
 	if (unlikely(__event_len < 0)) {				      \
 		lib_ring_buffer_lost_event_too_big(__chan->chan);	      \
 		goto __post;						      \
 	}								      \
-	__event_align = __event_get_align__##_name(tp_locvar);		      \
+	__event_align = __event_get_align__##_name(tp_locvar, __field_mask);  \
 	lib_ring_buffer_ctx_init(&__ctx, __chan->chan, &__lttng_probe_ctx, __event_len,  \
 				 __event_align, -1);			      \
 	__ret = __chan->ops->event_reserve(&__ctx, __event->id);	      \
@@ -1259,6 +1452,7 @@ static void __event_probe__##_name(void *__data)			      \
 	__chan->ops->event_commit(&__ctx);				      \
 __post:									      \
 	_code_post							      \
+__end:									      \
 	barrier();	/* use before un-reserve. */			      \
 	this_cpu_ptr(&lttng_dynamic_len_stack)->offset = __orig_dynamic_len_offset; \
 	return;								      \
@@ -1291,6 +1485,7 @@ static const struct lttng_event_desc __event_desc___##_map = {		\
 	.probe_callback = (void *) TP_PROBE_CB(_template),   		\
 	.nr_fields = ARRAY_SIZE(__event_fields___##_template),		\
 	.owner = THIS_MODULE,				     		\
+	.filter_locvar_mask = __event_filter_locvar_mask__##_template,	\
 };
 
 #undef LTTNG_TRACEPOINT_EVENT_INSTANCE_MAP
@@ -0,0 +1,73 @@
+#ifndef _LTTNG_WRAPPER_LZ4_H
+#define _LTTNG_WRAPPER_LZ4_H
+
+/*
+ * wrapper/lz4.h
+ *
+ * wrapper around the in-kernel LZ4 compression API, which changed in
+ * Linux 4.11.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; only
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <linux/version.h>
+#include <linux/lz4.h>
+
+#define LTTNG_LZ4_MEM_COMPRESS		LZ4_MEM_COMPRESS
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0))
+
+#define lttng_lz4_compressbound(isize)	LZ4_COMPRESSBOUND(isize)
+
+/*
+ * Returns the compressed size, or 0 if the output does not fit in
+ * dst_len bytes.
+ */
+static inline
+size_t lttng_lz4_compress(const void *src, size_t src_len,
+		void *dst, size_t dst_len, void *wrkmem)
+{
+	int ret;
+
+	ret = LZ4_compress_default(src, dst, src_len, dst_len, wrkmem);
+	if (ret <= 0)
+		return 0;
+	return ret;
+}
+
+#else /* #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)) */
+
+#define lttng_lz4_compressbound(isize)	lz4_compressbound(isize)
+
+/*
+ * Returns the compressed size, or 0 if the output does not fit in
+ * dst_len bytes. The legacy API requires a worst-case sized destination.
+ */
+static inline
+size_t lttng_lz4_compress(const void *src, size_t src_len,
+		void *dst, size_t dst_len, void *wrkmem)
+{
+	size_t out_len = dst_len;
+
+	if (dst_len < lz4_compressbound(src_len))
+		return 0;
+	if (lz4_compress(src, src_len, dst, &out_len, wrkmem))
+		return 0;
+	return out_len;
+}
+
+#endif /* #else #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)) */
+
+#endif /* _LTTNG_WRAPPER_LZ4_H */
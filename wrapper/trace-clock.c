@@ -21,12 +21,418 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <linux/err.h>
 #include <wrapper/trace-clock.h>
+#include <lttng-abi.h>
+
+#ifdef CONFIG_X86
+#include <asm/tsc.h>
+#endif
+
+#if (!defined(CONFIG_HAVE_TRACE_CLOCK) && defined(CONFIG_X86))
+/*
+ * Per-cpu streams are merged by timestamp, so the TSC must tick at a
+ * constant rate, keep ticking in idle, and be synchronized across CPUs.
+ * The fast monotonic clock has the same requirements, as it extrapolates
+ * the TSC between ticks.
+ */
+static bool trace_clock_tsc_usable(void)
+{
+	return tsc_khz && boot_cpu_has(X86_FEATURE_CONSTANT_TSC)
+		&& boot_cpu_has(X86_FEATURE_NONSTOP_TSC)
+		&& !check_tsc_unstable();
+}
+#endif
 
 #ifdef LTTNG_USE_NMI_SAFE_CLOCK
 DEFINE_PER_CPU(u64, lttng_last_tsc);
 EXPORT_PER_CPU_SYMBOL(lttng_last_tsc);
-#endif /* #ifdef LTTNG_USE_NMI_SAFE_CLOCK */
+#endif
+
+#ifdef LTTNG_USE_FAST_CLOCK
+DEFINE_PER_CPU(struct lttng_fast_clock, lttng_fast_clock);
+EXPORT_PER_CPU_SYMBOL(lttng_fast_clock);
+
+/* Shortest calibration interval enabling the fast clock. */
+#define LTTNG_FAST_CLOCK_MIN_CALIB_NS	(NSEC_PER_SEC / 10)
+
+static u64 lttng_fast_clock_value(const struct lttng_clock_snapshot *snap,
+		u64 cycles)
+{
+	u64 delta = cycles - snap->cycles;
+
+	if ((s64) delta < 0)
+		delta = 0;
+	return snap->ns + mul_u64_u32_shr(delta, snap->mult,
+					  LTTNG_FAST_CLOCK_SHIFT);
+}
+
+/*
+ * Ensure the slow path never returns values lower than "ns", already
+ * returned from the fast path.
+ */
+static void lttng_last_tsc_raise(u64 ns)
+{
+	u64 *last_tsc_ptr = lttng_this_cpu_ptr(&lttng_last_tsc);
+	u64 last;
+
+	do {
+		last = READ_ONCE(*last_tsc_ptr);
+		if (U64_MAX / 2 < ns - last)
+			return;
+	} while (cmpxchg64_local(last_tsc_ptr, last, ns) != last);
+}
+
+/*
+ * Returns the cycles to ns multiplier measured over the last 1 to 2
+ * seconds, or 0 if the counter is not usable or not calibrated yet.
+ */
+static u32 lttng_fast_clock_calibrate(struct lttng_fast_clock *fc,
+		u64 cycles, u64 now)
+{
+	u64 dcycles = cycles - fc->calib_cycles;
+	u64 dns = now - fc->calib_ns;
+	u64 mult;
+
+	if (!fc->calib_ns || (s64) dcycles <= 0 || (s64) dns <= 0)
+		goto restart;
+	if (dns < LTTNG_FAST_CLOCK_MIN_CALIB_NS)
+		return 0;
+	mult = div64_u64(dns << LTTNG_FAST_CLOCK_SHIFT, dcycles);
+	if (!mult || mult > U32_MAX)
+		goto restart;
+	if (dns >= NSEC_PER_SEC) {
+		fc->calib_cycles = fc->next_cycles;
+		fc->calib_ns = fc->next_ns;
+		fc->next_cycles = cycles;
+		fc->next_ns = now;
+	}
+	return mult;
+
+restart:
+	fc->calib_cycles = fc->next_cycles = cycles;
+	fc->calib_ns = fc->next_ns = now;
+	return 0;
+}
+
+/*
+ * Called with preemption disabled, on the first clock read of each tick.
+ * See wrapper/trace-clock.h.
+ */
+u64 lttng_fast_clock_refresh(void)
+{
+	struct lttng_fast_clock *fc = lttng_this_cpu_ptr(&lttng_fast_clock);
+	const struct lttng_clock_snapshot *old;
+	struct lttng_clock_snapshot *new;
+	unsigned long flags;
+	u64 now, cycles, ret;
+	u32 mult;
+
+	if (unlikely(READ_ONCE(fc->refreshing))) {
+		/* NMI nested over a refresh. */
+		old = &fc->snap[READ_ONCE(fc->idx)];
+		if (old->mult)
+			return lttng_fast_clock_value(old, get_cycles());
+		return trace_clock_monotonic_slow();
+	}
+
+	local_irq_save(flags);
+	WRITE_ONCE(fc->refreshing, 1);
+	barrier();
+	WRITE_ONCE(fc->jiffies, jiffies);
+	old = &fc->snap[fc->idx];
+	new = &fc->snap[!fc->idx];
+
+	now = trace_clock_monotonic_slow();
+	cycles = get_cycles();
+	if (likely(trace_clock_tsc_usable()))
+		mult = lttng_fast_clock_calibrate(fc, cycles, now);
+	else
+		mult = 0;
+	if (mult && old->mult) {
+		s64 drift = now - lttng_fast_clock_value(old, cycles);
+		s64 elapsed = now - old->ns;
+		u64 max_drift = LTTNG_FAST_CLOCK_MAX_DRIFT_NS;
+
+		/* The kernel clock may be slewed by NTP in the meantime. */
+		if (elapsed > 0)
+			max_drift += div_u64((u64) elapsed
+					* LTTNG_FAST_CLOCK_MAX_SLEW_PPM, 1000000);
+		if ((u64) abs(drift) > max_drift) {
+			mult = 0;
+			fc->calib_cycles = fc->next_cycles = cycles;
+			fc->calib_ns = fc->next_ns = now;
+		}
+	}
+
+	if (mult) {
+		u64 ahead = div_u64((u64) LTTNG_FAST_CLOCK_AHEAD_NS
+				<< LTTNG_FAST_CLOCK_SHIFT, mult);
+
+		for (;;) {
+			new->cycles = cycles + ahead;
+			new->ns = now + LTTNG_FAST_CLOCK_AHEAD_NS;
+			if (old->mult)
+				new->ns = max(new->ns,
+					lttng_fast_clock_value(old, new->cycles));
+			else
+				new->ns = max(new->ns, READ_ONCE(
+					*lttng_this_cpu_ptr(&lttng_last_tsc)));
+			new->mult = mult;
+			barrier();
+			/* Publish before reaching the origin. */
+			if ((s64) (get_cycles() - new->cycles) < 0)
+				break;
+			now = trace_clock_monotonic_slow();
+			cycles = get_cycles();
+		}
+		ret = new->ns;
+	} else {
+		new->mult = 0;
+		if (old->mult) {
+			u64 ahead = div_u64((u64) LTTNG_FAST_CLOCK_AHEAD_NS
+					<< LTTNG_FAST_CLOCK_SHIFT, old->mult);
+			u64 bound;
+
+			/*
+			 * Cover values returned from the previous snapshot
+			 * until it is unpublished.
+			 */
+			do {
+				bound = get_cycles() + ahead;
+				lttng_last_tsc_raise(lttng_fast_clock_value(old,
+						bound));
+				barrier();
+			} while ((s64) (get_cycles() - bound) >= 0);
+		}
+		ret = trace_clock_monotonic_slow();
+	}
+	barrier();
+	WRITE_ONCE(fc->idx, !fc->idx);
+	barrier();
+	WRITE_ONCE(fc->refreshing, 0);
+	local_irq_restore(flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(lttng_fast_clock_refresh);
+#endif /* #ifdef LTTNG_USE_FAST_CLOCK */
+
+static u64 trace_clock_read64_default(void)
+{
+	return trace_clock_read64();
+}
+
+static u64 trace_clock_freq_default(void)
+{
+	return trace_clock_freq();
+}
+
+static int trace_clock_uuid_default(char *uuid)
+{
+	return trace_clock_uuid(uuid);
+}
+
+static const char *trace_clock_name_default(void)
+{
+	return trace_clock_name();
+}
+
+static const char *trace_clock_description_default(void)
+{
+	return trace_clock_description();
+}
+
+/* Global trace clock: monotonic, or the registered clock plugin. */
+const struct lttng_trace_clock lttng_default_trace_clock = {
+	.read64 = trace_clock_read64_default,
+	.freq = trace_clock_freq_default,
+	.uuid = trace_clock_uuid_default,
+	.name = trace_clock_name_default,
+	.description = trace_clock_description_default,
+};
+
+#ifndef CONFIG_HAVE_TRACE_CLOCK
+
+static const struct lttng_trace_clock lttng_monotonic_trace_clock = {
+	.read64 = trace_clock_read64_monotonic,
+	.freq = trace_clock_freq_monotonic,
+	.uuid = trace_clock_uuid_monotonic,
+	.name = trace_clock_name_monotonic,
+	.description = trace_clock_description_monotonic,
+};
+
+#if (defined(LTTNG_USE_NMI_SAFE_CLOCK) \
+	&& LINUX_VERSION_CODE >= KERNEL_VERSION(4,8,0))
+/*
+ * Same per-cpu monotonicity fixup as trace_clock_monotonic_slow(), for
+ * the other fast NMI-safe kernel clocks. Called with preemption
+ * disabled, "last" being read before "now".
+ */
+static u64 trace_clock_fast_fixup(u64 *last_ptr, u64 last, u64 now)
+{
+	u64 result;
+
+	if (U64_MAX / 2 < now - last)
+		now = last;
+	result = cmpxchg64_local(last_ptr, last, now);
+	return result == last ? now : result;
+}
+#endif
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0))
+
+#if (defined(LTTNG_USE_NMI_SAFE_CLOCK) \
+	&& LINUX_VERSION_CODE >= KERNEL_VERSION(4,8,0))
+static DEFINE_PER_CPU(u64, lttng_last_raw);
+
+static u64 trace_clock_read64_monotonic_raw(void)
+{
+	u64 *last_ptr, last, now;
+
+	preempt_disable();
+	last_ptr = lttng_this_cpu_ptr(&lttng_last_raw);
+	last = *last_ptr;
+	barrier();
+	now = trace_clock_fast_fixup(last_ptr, last, ktime_get_raw_fast_ns());
+	preempt_enable();
+	return now;
+}
+#else
+static u64 trace_clock_read64_monotonic_raw(void)
+{
+	/* Not NMI-safe: refuse to trace from NMIs, as the monotonic wrapper. */
+	if (in_nmi())
+		return (u64) -EIO;
+	return ktime_get_raw_ns();
+}
+#endif
+
+#if (defined(LTTNG_USE_NMI_SAFE_CLOCK) \
+	&& LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0))
+static DEFINE_PER_CPU(u64, lttng_last_boot);
+
+static u64 trace_clock_read64_boottime(void)
+{
+	u64 *last_ptr, last, now;
+
+	preempt_disable();
+	last_ptr = lttng_this_cpu_ptr(&lttng_last_boot);
+	last = *last_ptr;
+	barrier();
+	now = trace_clock_fast_fixup(last_ptr, last, ktime_get_boot_fast_ns());
+	preempt_enable();
+	return now;
+}
+#else
+static u64 trace_clock_read64_boottime(void)
+{
+	if (in_nmi())
+		return (u64) -EIO;
+	return ktime_get_boot_ns();
+}
+#endif
+
+static const char *trace_clock_name_monotonic_raw(void)
+{
+	return "monotonic_raw";
+}
+
+static const char *trace_clock_description_monotonic_raw(void)
+{
+	return "Monotonic Clock, not adjusted by NTP";
+}
+
+static const char *trace_clock_name_boottime(void)
+{
+	return "boottime";
+}
+
+static const char *trace_clock_description_boottime(void)
+{
+	return "Monotonic Clock, including time spent in suspend";
+}
+
+/*
+ * The boot id identifies the monotonic clock domain: clocks with another
+ * time base have no uuid, rather than claim to share that domain.
+ */
+static const struct lttng_trace_clock lttng_monotonic_raw_trace_clock = {
+	.read64 = trace_clock_read64_monotonic_raw,
+	.freq = trace_clock_freq_monotonic,
+	.name = trace_clock_name_monotonic_raw,
+	.description = trace_clock_description_monotonic_raw,
+};
+
+static const struct lttng_trace_clock lttng_boottime_trace_clock = {
+	.read64 = trace_clock_read64_boottime,
+	.freq = trace_clock_freq_monotonic,
+	.name = trace_clock_name_boottime,
+	.description = trace_clock_description_boottime,
+};
+
+#endif /* #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)) */
+
+#ifdef CONFIG_X86
+static u64 trace_clock_read64_tsc(void)
+{
+	return (u64) get_cycles();
+}
+
+static u64 trace_clock_freq_tsc(void)
+{
+	return (u64) tsc_khz * 1000;
+}
+
+static const char *trace_clock_name_tsc(void)
+{
+	return "tsc";
+}
+
+static const char *trace_clock_description_tsc(void)
+{
+	return "x86 Time Stamp Counter";
+}
+
+static const struct lttng_trace_clock lttng_tsc_trace_clock = {
+	.read64 = trace_clock_read64_tsc,
+	.freq = trace_clock_freq_tsc,
+	.name = trace_clock_name_tsc,
+	.description = trace_clock_description_tsc,
+};
+
+#endif /* #ifdef CONFIG_X86 */
+
+#endif /* #ifndef CONFIG_HAVE_TRACE_CLOCK */
+
+const struct lttng_trace_clock *lttng_trace_clock_get(int clock)
+{
+	switch (clock) {
+	case LTTNG_KERNEL_CLOCK_DEFAULT:
+		return &lttng_default_trace_clock;
+#ifndef CONFIG_HAVE_TRACE_CLOCK
+	case LTTNG_KERNEL_CLOCK_MONOTONIC:
+		return &lttng_monotonic_trace_clock;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0))
+	case LTTNG_KERNEL_CLOCK_MONOTONIC_RAW:
+		return &lttng_monotonic_raw_trace_clock;
+	case LTTNG_KERNEL_CLOCK_BOOTTIME:
+		return &lttng_boottime_trace_clock;
+#endif
+#ifdef CONFIG_X86
+	case LTTNG_KERNEL_CLOCK_TSC:
+		if (!trace_clock_tsc_usable())
+			return ERR_PTR(-EOPNOTSUPP);
+		return &lttng_tsc_trace_clock;
+#endif
+#endif /* #ifndef CONFIG_HAVE_TRACE_CLOCK */
+	default:
+		/* Known clock, not available with this kernel or architecture. */
+		if (clock > LTTNG_KERNEL_CLOCK_DEFAULT
+				&& clock <= LTTNG_KERNEL_CLOCK_TSC)
+			return ERR_PTR(-EOPNOTSUPP);
+		return ERR_PTR(-EINVAL);
+	}
+}
 
 #ifdef LTTNG_CLOCK_NMI_SAFE_BROKEN
 #warning "Your kernel implements a bogus nmi-safe clock source. Falling back to the non-nmi-safe clock source, which discards events traced from NMI context. Upgrade your kernel to resolve this situation."
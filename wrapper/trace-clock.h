@@ -33,6 +33,9 @@
 #include <linux/time.h>
 #include <linux/hrtimer.h>
 #include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include <linux/timex.h>
+#include <linux/math64.h>
 #include <linux/version.h>
 #include <asm/local.h>
 #include <lttng-kernel-version.h>
@@ -74,14 +77,73 @@ extern struct lttng_trace_clock *lttng_trace_clock;
 #define LTTNG_USE_NMI_SAFE_CLOCK
 #endif
 
+/*
+ * The per-cpu fast clock extrapolates the cycle counter between ticks,
+ * which is only accurate if the counter rate is constant: it is limited
+ * to x86, and only enabled at runtime with a constant, nonstop and stable
+ * TSC (see trace_clock_tsc_usable()).
+ */
+#if (defined(LTTNG_USE_NMI_SAFE_CLOCK) && defined(CONFIG_X86))
+#define LTTNG_USE_FAST_CLOCK
+#endif
+
 #ifdef LTTNG_USE_NMI_SAFE_CLOCK
 
 DECLARE_PER_CPU(u64, lttng_last_tsc);
 
+#ifdef LTTNG_USE_FAST_CLOCK
+/*
+ * Per-cpu fast clock: scale the raw cycle counter from a per-cpu snapshot
+ * of the kernel monotonic clock, refreshed on the first read following
+ * each tick. Reads between ticks need neither ktime_get_mono_fast_ns() nor
+ * the cmpxchg keeping lttng_last_tsc monotonic.
+ *
+ * Snapshots are double-buffered: the refresh, performed with interrupts
+ * off, fills the unused copy and publishes it with a single store of
+ * "idx". The new snapshot origin is placed slightly ahead in time
+ * (LTTNG_FAST_CLOCK_AHEAD_NS), at a value no lower than the previous
+ * snapshot gives at that point, and reads before the origin return the
+ * origin value. The clock therefore stays monotonic per cpu across
+ * refreshes, even for NMIs reading the previous snapshot while it is
+ * being replaced.
+ *
+ * The snapshot multiplier is 0 when the fast clock is disabled: when the
+ * TSC is not usable, while calibrating the counter against the kernel
+ * clock, or after it drifted from the kernel clock by more than the NTP
+ * slew allowed since the previous snapshot
+ * (LTTNG_FAST_CLOCK_MAX_SLEW_PPM), plus LTTNG_FAST_CLOCK_MAX_DRIFT_NS.
+ * Reads then use trace_clock_monotonic_slow() until the next refresh
+ * enables it again.
+ */
+#define LTTNG_FAST_CLOCK_SHIFT		24
+#define LTTNG_FAST_CLOCK_AHEAD_NS	500
+#define LTTNG_FAST_CLOCK_MAX_SLEW_PPM	500	/* NTP frequency limit */
+#define LTTNG_FAST_CLOCK_MAX_DRIFT_NS	1000
+
+struct lttng_clock_snapshot {
+	u64 cycles;			/* Counter value at origin */
+	u64 ns;				/* Clock value at origin */
+	u32 mult;			/* Cycles to ns multiplier, 0 if disabled */
+};
+
+struct lttng_fast_clock {
+	struct lttng_clock_snapshot snap[2];
+	unsigned int idx;		/* Published snapshot */
+	int refreshing;			/* Refresh in progress */
+	unsigned long jiffies;		/* Tick of the last refresh */
+	u64 calib_cycles, calib_ns;	/* Calibration interval start */
+	u64 next_cycles, next_ns;	/* Next calibration interval start */
+};
+
+DECLARE_PER_CPU(struct lttng_fast_clock, lttng_fast_clock);
+
+u64 lttng_fast_clock_refresh(void);
+#endif /* #ifdef LTTNG_USE_FAST_CLOCK */
+
 /*
  * Sometimes called with preemption enabled. Can be interrupted.
  */
-static inline u64 trace_clock_monotonic_wrapper(void)
+static inline u64 trace_clock_monotonic_slow(void)
 {
 	u64 now, last, result;
 	u64 *last_tsc_ptr;
@@ -115,6 +177,50 @@ static inline u64 trace_clock_monotonic_wrapper(void)
 	}
 }
 
+#ifdef LTTNG_USE_FAST_CLOCK
+/*
+ * Sometimes called with preemption enabled. Can be interrupted.
+ */
+static inline u64 trace_clock_monotonic_wrapper(void)
+{
+	struct lttng_fast_clock *fc;
+	const struct lttng_clock_snapshot *snap;
+	u64 delta, now;
+
+	preempt_disable();
+	fc = lttng_this_cpu_ptr(&lttng_fast_clock);
+	if (unlikely(READ_ONCE(fc->jiffies) != jiffies))
+		goto refresh;
+	snap = &fc->snap[READ_ONCE(fc->idx)];
+	if (unlikely(!snap->mult))
+		goto slow;
+	delta = (u64) get_cycles() - snap->cycles;
+	if ((s64) delta < 0)
+		delta = 0;	/* Before origin */
+	now = snap->ns + mul_u64_u32_shr(delta, snap->mult,
+					 LTTNG_FAST_CLOCK_SHIFT);
+	preempt_enable();
+	return now;
+
+refresh:
+	now = lttng_fast_clock_refresh();
+	preempt_enable();
+	return now;
+
+slow:
+	preempt_enable();
+	return trace_clock_monotonic_slow();
+}
+#else /* #ifdef LTTNG_USE_FAST_CLOCK */
+/*
+ * Sometimes called with preemption enabled. Can be interrupted.
+ */
+static inline u64 trace_clock_monotonic_wrapper(void)
+{
+	return trace_clock_monotonic_slow();
+}
+#endif /* #else #ifdef LTTNG_USE_FAST_CLOCK */
+
 #else /* #ifdef LTTNG_USE_NMI_SAFE_CLOCK */
 static inline u64 trace_clock_monotonic_wrapper(void)
 {
@@ -238,4 +344,13 @@ static inline const char *trace_clock_description(void)
 
 #endif /* CONFIG_HAVE_TRACE_CLOCK */
 
+/*
+ * Clocks a session can be traced with, by enum lttng_kernel_clock. The
+ * default clock is the global trace clock above. Returns an ERR_PTR()
+ * if the clock is unknown or unavailable.
+ */
+extern const struct lttng_trace_clock lttng_default_trace_clock;
+
+const struct lttng_trace_clock *lttng_trace_clock_get(int clock);
+
 #endif /* _LTTNG_TRACE_CLOCK_H */